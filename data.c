@@ -19,24 +19,34 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "data.h"
 
 /* Macros */
 
 #define C_DARRAY_NBBY 8
-#define C_DARRAY_USED_MASK(B) ~(1 << (B))
-#define C_DARRAY_FREE_MASK(B) (1 << (B))
+#define C_DARRAY_WORD_BITS 64
+#define C_DARRAY_WORDS(N) (((N) + C_DARRAY_WORD_BITS - 1) / C_DARRAY_WORD_BITS)
+#define C_DARRAY_BIT(I) ((uint64_t)1 << ((I) % C_DARRAY_WORD_BITS))
+#define C_DARRAY_ISFREE(A, I)                                           \
+  ((A)->free_list[(I) / C_DARRAY_WORD_BITS] & C_DARRAY_BIT(I))
 
 /* Functions */
 
 c_darray_t *C_darray_create(uint_t resize, size_t elemsz)
 {
   c_darray_t *a;
-  char *b;
-  uint_t i;
 
   if(resize < 1 || resize > C_DARRAY_MAX_RESIZE || !elemsz)
     return(NULL);
@@ -47,11 +57,11 @@ c_darray_t *C_darray_create(uint_t resize, size_t elemsz)
   a->elemsz = elemsz;
   a->mem = (void *)C_malloc(a->resize * a->elemsz, char);
   a->size = a->resize;
-  a->isize = a->iresize;  
+  a->isize = C_DARRAY_WORDS(a->size);
   a->bot = a->del_count = 0;
-  a->free_list = C_malloc(a->iresize, char);
-  for(i = a->iresize, b = a->free_list; i--; b++)
-    *b = ~0;
+  a->free_list = C_newa(a->isize, uint64_t);
+  a->free_summary = C_newa(C_DARRAY_WORDS(a->isize), uint64_t);
+  a->free_hint = 0;
 
   return(a);
 }
@@ -66,54 +76,92 @@ void C_darray_destroy(c_darray_t *a)
     return;
 
   C_free(a->free_list);
-  C_free(a->mem);
+  C_free(a->free_summary);
+  if(a->mapped)
+    munmap(a->mem, a->mapped);
+  else
+    C_free(a->mem);
   C_free(a);
 }
 
+/*
+ * room for the free bits of size elements, new words cleared.
+ */
+
+static c_bool_t __C_darray_grow_free_list(c_darray_t *a, uint_t size)
+{
+  uint_t words = C_DARRAY_WORDS(size), o = a->isize, so, sn;
+  uint64_t *p;
+
+  if(words <= o)
+    return(TRUE);
+
+  if(!(p = C_realloc(a->free_list, words, uint64_t)))
+    return(FALSE);
+  a->free_list = p;
+  memset((void *)(p + o), 0, (words - o) * sizeof(uint64_t));
+
+  so = C_DARRAY_WORDS(o), sn = C_DARRAY_WORDS(words);
+  if(sn > so)
+  {
+    if(!(p = C_realloc(a->free_summary, sn, uint64_t)))
+      return(FALSE);
+    a->free_summary = p;
+    memset((void *)(p + so), 0, (sn - so) * sizeof(uint64_t));
+  }
+  a->isize = words;
+
+  return(TRUE);
+}
+
 /*
  */
 
 void *C_darray_store(c_darray_t *a, const void *data, uint_t *index)
 {
-  uint_t e, bit, byte, o;
-  char b, *bp;
-  div_t dv;
+  uint_t e, w;
+  void *m;
 
   if(!a)
     return(NULL);
+  if(a->rdonly)
+    return(NULL);
   
   if(!a->del_count)
   {
     if(a->bot == a->size)
     {
-      if((a->size / C_DARRAY_NBBY) == a->isize)
+      if(!__C_darray_grow_free_list(a, a->size + a->resize))
+        return(NULL);
+      if(a->mapped)
       {
-        o = a->isize;
-        a->free_list = C_realloc(a->free_list, (a->isize += a->iresize), char);
-        memset((void *)(a->free_list + o), ~0, a->iresize);
-        
+        // off the file mapping, to the heap
+        if(!(m = C_malloc((a->size + a->resize) * a->elemsz, char)))
+          return(NULL);
+        memcpy(m, a->mem, a->bot * a->elemsz);
+        munmap(a->mem, a->mapped);
+        a->mapped = 0;
       }
-      a->mem = (void *)C_realloc(a->mem, (a->size += a->resize) * a->elemsz,
-                                 char);
+      else if(!(m = C_realloc(a->mem, (a->size + a->resize) * a->elemsz, char)))
+        return(NULL);
+      a->mem = m;
+      a->size += a->resize;
     }
-    dv = div((e = (a->bot)++), C_DARRAY_NBBY);
-    byte = dv.quot, bit = dv.rem;
+    e = (a->bot)++;
   }
   else
   {
+    // the lowest deleted element, through the summary
     a->del_count--;
-    for(byte = 0, bp = a->free_list; !*bp; byte++, bp++);
-    b = *bp;
-    for(bit = 0; bit < C_DARRAY_NBBY; bit++)
-    {
-      if(b & 1)
-        break;
-      b >>= 1;
-    }
-    e = C_DARRAY_NBBY * byte + bit;
+    while(!a->free_summary[a->free_hint])
+      a->free_hint++;
+    w = a->free_hint * C_DARRAY_WORD_BITS
+      + __builtin_ctzll(a->free_summary[a->free_hint]);
+    e = w * C_DARRAY_WORD_BITS + __builtin_ctzll(a->free_list[w]);
+    if(!(a->free_list[w] &= ~C_DARRAY_BIT(e)))
+      a->free_summary[a->free_hint] &= ~C_DARRAY_BIT(w);
   }
   if(index) *index = e;
-  *(a->free_list + byte) &= C_DARRAY_USED_MASK(bit);
 
   return(memcpy((void *)(a->mem + (e * a->elemsz)), data, a->elemsz));
 }
@@ -123,16 +171,12 @@ void *C_darray_store(c_darray_t *a, const void *data, uint_t *index)
 
 void *C_darray_restore(c_darray_t *a, uint_t index)
 {
-  div_t dv;
-
   if(!a)
     return(NULL);
   if(index >= a->bot)
     return(NULL);
 
-  dv = div(index, C_DARRAY_NBBY);
-
-  return((*(a->free_list + dv.quot) & C_DARRAY_FREE_MASK(dv.rem))
+  return(C_DARRAY_ISFREE(a, index)
          ? NULL : (void *)(a->mem + (index * a->elemsz)));
 }
 
@@ -141,19 +185,22 @@ void *C_darray_restore(c_darray_t *a, uint_t index)
 
 c_bool_t C_darray_delete(c_darray_t *a, uint_t index)
 {
-  div_t dv;
-  char *b;
+  uint_t w;
 
   if(!a)
     return(FALSE);
+  if(a->rdonly)
+    return(FALSE);
   if(index >= a->bot)
     return(FALSE);
-  dv = div(index, C_DARRAY_NBBY);
-  b = (a->free_list + dv.quot);
-  if(*b & C_DARRAY_FREE_MASK(dv.rem))
+  if(C_DARRAY_ISFREE(a, index))
     return(FALSE);
 
-  *b |= C_DARRAY_FREE_MASK(dv.rem);
+  w = index / C_DARRAY_WORD_BITS;
+  a->free_list[w] |= C_DARRAY_BIT(index);
+  a->free_summary[w / C_DARRAY_WORD_BITS] |= C_DARRAY_BIT(w);
+  if(w / C_DARRAY_WORD_BITS < a->free_hint)
+    a->free_hint = w / C_DARRAY_WORD_BITS;
   a->del_count++;
 
   return(TRUE);
@@ -162,86 +209,329 @@ c_bool_t C_darray_delete(c_darray_t *a, uint_t index)
 /*
  */
 
-c_darray_t *C_darray_load(const char *path)
+/* file header, see C_darray_save() */
+
+typedef struct
 {
-  FILE *fp;
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t elemsz;
+  uint64_t bot;
+  uint64_t del_count;
+  uint64_t words;
+  uint64_t mem_offset;
+  uint32_t resize;
+  uint32_t reserved;
+} __c_darray_header_t;
+
+typedef char __c_darray_header_size_check
+  [(sizeof(__c_darray_header_t) == C_DARRAY_FILE_HEADER) ? 1 : -1];
+
+#define C_DARRAY_BYTE_ORDER 0x01020304U
+
+static c_bool_t __C_darray_header_ok(const __c_darray_header_t *h, off_t fsize)
+{
+  if(memcmp(h->magic, C_DARRAY_FILE_MAGIC, sizeof(h->magic))
+     || h->version != C_DARRAY_FILE_VERSION
+     || h->byte_order != C_DARRAY_BYTE_ORDER)
+    return(FALSE);
+  if(!h->elemsz || h->bot > UINT_MAX
+     || h->resize < 1 || h->resize > C_DARRAY_MAX_RESIZE)
+    return(FALSE);
+  if(h->words != C_DARRAY_WORDS(h->bot) || h->mem_offset % C_DARRAY_FILE_ALIGN
+     || h->mem_offset < C_DARRAY_FILE_HEADER + h->words * sizeof(uint64_t))
+    return(FALSE);
+  if(h->bot && h->elemsz > (SIZE_MAX - h->mem_offset) / h->bot)
+    return(FALSE);
+  if(h->bot && (uint64_t)fsize < h->mem_offset + h->bot * h->elemsz)
+    return(FALSE);
+
+  return(TRUE);
+}
+
+/*
+ */
+
+static void __C_darray_summarize(c_darray_t *a)
+{
+  uint_t w;
+
+  a->del_count = 0;
+  for(w = 0; w < a->isize; w++)
+  {
+    if(a->free_list[w])
+    {
+      a->free_summary[w / C_DARRAY_WORD_BITS] |= C_DARRAY_BIT(w);
+      a->del_count += __builtin_popcountll(a->free_list[w]);
+    }
+  }
+  a->free_hint = 0;
+}
+
+/*
+ * the free list is read in, the elements are mapped and faulted in
+ * as they are used. a copy-on-write array is moved to the heap once
+ * it grows.
+ */
+
+c_darray_t *C_darray_map(const char *path, int mode)
+{
+  __c_darray_header_t h;
+  struct stat st;
   c_darray_t *a;
+  size_t len;
+  void *m;
+  int fd;
 
   if(!path)
     return(NULL);
   if(!*path)
     return(NULL);
-  if(!(fp = fopen(path, "r")))
+  if(mode != C_DARRAY_MAP_RDONLY && mode != C_DARRAY_MAP_PRIVATE)
+    return(NULL);
+  if((fd = open(path, O_RDONLY)) < 0)
     return(NULL);
 
-  a = C_new(c_darray_t);
-  if(fread((void *)a, sizeof(c_darray_t), (size_t)1, fp) != 1)
+  if(fstat(fd, &st) || read(fd, &h, sizeof(h)) != sizeof(h)
+     || !__C_darray_header_ok(&h, st.st_size))
   {
-    C_free(a);
-    fclose(fp);
+    close(fd);
     return(NULL);
   }
 
-  a->free_list = C_newstr(a->isize);
-  if(fread((void *)a->free_list, sizeof(char), a->isize, fp) != a->isize)
+  if(!h.bot)
   {
-    fclose(fp);
+    close(fd);
+    if((a = C_darray_create(h.resize, h.elemsz)))
+      a->rdonly = (mode == C_DARRAY_MAP_RDONLY);
+    return(a);
+  }
+
+  a = C_new(c_darray_t);
+  a->elemsz = h.elemsz;
+  a->iresize = h.resize;
+  a->resize = h.resize * C_DARRAY_NBBY;
+  a->size = a->bot = h.bot;
+  a->isize = h.words;
+  a->free_list = C_newa(a->isize, uint64_t);
+  a->free_summary = C_newa(C_DARRAY_WORDS(a->isize), uint64_t);
+  len = a->isize * sizeof(uint64_t);
+  // a hole at or above bot would be reused past the mapped elements
+  if(!a->free_list || !a->free_summary
+     || pread(fd, (void *)a->free_list, len, C_DARRAY_FILE_HEADER) != (ssize_t)len
+     || ((a->bot % C_DARRAY_WORD_BITS)
+         && a->free_list[a->isize - 1] >> (a->bot % C_DARRAY_WORD_BITS)))
+  {
+    close(fd);
     C_free(a->free_list);
+    C_free(a->free_summary);
     C_free(a);
     return(NULL);
   }
 
-  a->mem = (void *)C_malloc(a->size * a->elemsz, char);
-  if(fread(a->mem, a->elemsz, a->size, fp) != a->size)
+  len = a->bot * a->elemsz;
+  m = mmap(NULL, len,
+           PROT_READ | ((mode == C_DARRAY_MAP_PRIVATE) ? PROT_WRITE : 0),
+           MAP_PRIVATE, fd, (off_t)h.mem_offset);
+  close(fd);
+  if(m == MAP_FAILED)
   {
-    fclose(fp);
     C_free(a->free_list);
-    C_free(a->mem);
+    C_free(a->free_summary);
     C_free(a);
     return(NULL);
   }
-  
-  fclose(fp);
+
+  a->mem = m;
+  a->mapped = len;
+  a->rdonly = (mode == C_DARRAY_MAP_RDONLY);
+  __C_darray_summarize(a);
+
   return(a);
 }
 
 /*
  */
 
+c_darray_t *C_darray_load(const char *path)
+{
+  return(C_darray_map(path, C_DARRAY_MAP_PRIVATE));
+}
+
+/*
+ * written aside then renamed over path, which arrays mapped from it
+ * keep using.
+ */
+
 c_bool_t C_darray_save(c_darray_t *a, const char *path)
 {
+  __c_darray_header_t h;
   FILE *fp;
+  char *tmp;
+  uint_t words;
 
   if(!a || !path)
     return(FALSE);
   if(!*path)
     return(FALSE);
-  if(!(fp = fopen(path, "w")))
-    return(FALSE);
 
-  if(fwrite((void *)a, sizeof(c_darray_t), (size_t)1, fp) != 1)
+  words = C_DARRAY_WORDS(a->bot);
+  C_zero(&h, __c_darray_header_t);
+  memcpy(h.magic, C_DARRAY_FILE_MAGIC, sizeof(h.magic));
+  h.version = C_DARRAY_FILE_VERSION;
+  h.byte_order = C_DARRAY_BYTE_ORDER;
+  h.elemsz = a->elemsz;
+  h.bot = a->bot;
+  h.del_count = a->del_count;
+  h.words = words;
+  h.resize = a->iresize;
+  h.mem_offset = (C_DARRAY_FILE_HEADER + words * sizeof(uint64_t)
+                  + C_DARRAY_FILE_ALIGN - 1)
+    / C_DARRAY_FILE_ALIGN * C_DARRAY_FILE_ALIGN;
+
+  if(!(tmp = C_newstr(strlen(path) + 4)))
+    return(FALSE);
+  sprintf(tmp, "%s.tmp", path);
+  if(!(fp = fopen(tmp, "w")))
   {
-    fclose(fp);
+    C_free(tmp);
     return(FALSE);
   }
 
-  if(fwrite((void *)a->free_list, sizeof(char), a->isize, fp) != a->isize)
+  if(fwrite((void *)&h, sizeof(h), (size_t)1, fp) != 1
+     || fwrite((void *)a->free_list, sizeof(uint64_t), words, fp) != words
+     || fseeko(fp, (off_t)h.mem_offset, SEEK_SET)
+     || fwrite(a->mem, a->elemsz, a->bot, fp) != a->bot)
   {
     fclose(fp);
+    unlink(tmp);
+    C_free(tmp);
     return(FALSE);
   }
 
-  if(fwrite(a->mem, a->elemsz, a->size, fp) != a->size)
+  if(fclose(fp) || rename(tmp, path))
   {
-    fclose(fp);
+    unlink(tmp);
+    C_free(tmp);
+    return(FALSE);
+  }
+
+  C_free(tmp);
+  return(TRUE);
+}
+
+/*
+ */
+
+/* live elements of word w from lo to hi excluded */
+
+static inline uint64_t __C_darray_live(c_darray_t *a, uint_t w, uint_t lo,
+                                       uint_t hi)
+{
+  uint_t base = w * C_DARRAY_WORD_BITS;
+  uint64_t m = ~a->free_list[w];
+
+  if(lo > base)
+    m &= ~(uint64_t)0 << (lo - base);
+  if(hi - base < C_DARRAY_WORD_BITS)
+    m &= C_DARRAY_BIT(hi) - 1;
+
+  return(m);
+}
+
+/*
+ * len live elements from src down to dst.
+ */
+
+static inline void __C_darray_slide(c_darray_t *a, uint_t src, uint_t dst,
+                                    uint_t len, uint_t *remap)
+{
+  uint_t k;
+
+  if(!len)
+    return;
+
+  if(src != dst)
+    memmove(a->mem + dst * a->elemsz, a->mem + src * a->elemsz,
+            len * a->elemsz);
+  if(remap)
+    for(k = 0; k < len; k++)
+      remap[src + k] = dst + k;
+}
+
+/*
+ */
+
+/*
+ * live runs slide down in one memmove each, over the free list words.
+ * if remap is not NULL, it has room for the C_darray_last() old
+ * indices and gets the new index of each, or C_DARRAY_NONE for the
+ * deleted ones. heap memory beyond what the live elements need is
+ * given back.
+ */
+
+c_bool_t C_darray_compact(c_darray_t *a, uint_t *remap)
+{
+  uint_t w, words, s, n, i, k, src = 0, len = 0, dst = 0;
+  uint64_t m;
+  void *p;
+
+  if(!a)
+    return(FALSE);
+  if(a->rdonly)
     return(FALSE);
+
+  if(remap)
+    memset((void *)remap, 0xff, a->bot * sizeof(uint_t));
+
+  words = C_DARRAY_WORDS(a->bot);
+  for(w = 0; w < words; w++)
+  {
+    for(m = __C_darray_live(a, w, 0, a->bot); m;)
+    {
+      s = __builtin_ctzll(m);
+      n = ~(m >> s) ? __builtin_ctzll(~(m >> s)) : C_DARRAY_WORD_BITS - s;
+      i = w * C_DARRAY_WORD_BITS + s;
+      if(len && src + len == i)
+        len += n;
+      else
+      {
+        __C_darray_slide(a, src, dst, len, remap);
+        dst += len;
+        src = i, len = n;
+      }
+      m = (s + n < C_DARRAY_WORD_BITS) ? m & (~(uint64_t)0 << (s + n)) : 0;
+    }
+  }
+  __C_darray_slide(a, src, dst, len, remap);
+  dst += len;
+
+  memset((void *)a->free_list, 0, words * sizeof(uint64_t));
+  memset((void *)a->free_summary, 0,
+         C_DARRAY_WORDS(words) * sizeof(uint64_t));
+  a->free_hint = 0;
+  a->del_count = 0;
+  a->bot = dst;
+
+  if(!a->mapped)
+  {
+    k = (dst + a->resize - 1) / a->resize * a->resize;
+    if(k < a->resize)
+      k = a->resize;
+    if(k < a->size && (p = C_realloc(a->mem, k * a->elemsz, char)))
+    {
+      a->mem = p;
+      a->size = k;
+    }
   }
 
-  fclose(fp);
   return(TRUE);
 }
 
 /*
+ * compacted in place, but for read-only mapped arrays that are copied
+ * into a new one.
  */
 
 c_darray_t *C_darray_defragment(c_darray_t *a)
@@ -253,7 +543,11 @@ c_darray_t *C_darray_defragment(c_darray_t *a)
   if(!a) return(NULL);
   if(!a->del_count) return(a);
 
-  n = C_darray_create(a->resize, a->elemsz);
+  if(!a->rdonly)
+    return(C_darray_compact(a, NULL) ? a : NULL);
+
+  if(!(n = C_darray_create(a->iresize, a->elemsz)))
+    return(NULL);
   for(i = 0; i < a->bot; i++)
     if((e = C_darray_restore(a, i)))
       C_darray_store(n, e, NULL);
@@ -263,6 +557,53 @@ c_darray_t *C_darray_defragment(c_darray_t *a)
 }
 
 /*
+ * a word of the free list at a time: runs of deleted elements are
+ * skipped 64 at a time, and the first live element of the next word
+ * is prefetched while the current one is handed to iter, with its
+ * offset from base. stops early once *stop is set, if not NULL.
+ */
+
+static c_bool_t __C_darray_iterate_range(c_darray_t *a,
+                                         c_bool_t (*iter)(void *elem,
+                                                          uint_t index,
+                                                          void *hook),
+                                         uint_t base, uint_t lo, uint_t hi,
+                                         void *hook, c_bool_t *stop)
+{
+  uint_t w, next, last, i;
+  uint64_t m, nm;
+
+  if(lo >= hi)
+    return(TRUE);
+
+  last = (hi - 1) / C_DARRAY_WORD_BITS;
+  w = lo / C_DARRAY_WORD_BITS;
+  m = __C_darray_live(a, w, lo, hi);
+  for(;;)
+  {
+    for(next = w + 1, nm = 0;
+        next <= last && !(nm = __C_darray_live(a, next, lo, hi)); next++);
+    if(nm)
+      __builtin_prefetch(a->mem + (next * C_DARRAY_WORD_BITS
+                                   + __builtin_ctzll(nm)) * a->elemsz);
+
+    for(; m; m &= m - 1)
+    {
+      i = w * C_DARRAY_WORD_BITS + __builtin_ctzll(m);
+      if(!iter(a->mem + i * a->elemsz, i - base, hook))
+        return(FALSE);
+    }
+    if(!nm || (stop && __atomic_load_n(stop, __ATOMIC_RELAXED)))
+      break;
+    w = next, m = nm;
+  }
+
+  return(!(stop && __atomic_load_n(stop, __ATOMIC_RELAXED)));
+}
+
+/*
+ * iter is given each live element from index on, with its offset from
+ * index.
  */
 
 c_bool_t C_darray_iterate(c_darray_t *a,
@@ -270,39 +611,154 @@ c_bool_t C_darray_iterate(c_darray_t *a,
                                            void *hook),
                           uint_t index, void *hook)
 {
-  char *byp, by, bil;
-  div_t dv;
-  uint_t i, left;
-  void *e;
+  if(!a || !iter)
+    return(FALSE);
+
+  return(__C_darray_iterate_range(a, iter, index, index, a->bot, hook, NULL));
+}
+
+/*
+ */
+
+typedef struct
+{
+  c_darray_t *a;
+  c_bool_t (*iter)(void *elem, uint_t index, void *hook);
+  uint_t base, lo, hi;
+  void *hook;
+  c_bool_t *stop;
+  c_bool_t ret;
+} __c_darray_job_t;
+
+static void *__C_darray_iterate_job(void *arg)
+{
+  __c_darray_job_t *job = arg;
+
+  if(!(job->ret = __C_darray_iterate_range(job->a, job->iter, job->base,
+                                           job->lo, job->hi, job->hook,
+                                           job->stop)))
+    __atomic_store_n(job->stop, TRUE, __ATOMIC_RELAXED);
+
+  return(NULL);
+}
+
+/*
+ * same as C_darray_iterate(), split in word aligned ranges of at
+ * least C_DARRAY_PARALLEL_MIN elements over up to nthreads threads,
+ * the calling one included. iter is called concurrently, and must not
+ * change the array. returns once all threads are done, FALSE if any
+ * iter returned FALSE, which stops the others early.
+ */
+
+c_bool_t C_darray_iterate_parallel(c_darray_t *a,
+                                   c_bool_t (*iter)(void *elem, uint_t index,
+                                                    void *hook),
+                                   uint_t index, void *hook, uint_t nthreads)
+{
+  c_bool_t stop = FALSE;
+  __c_darray_job_t *jobs;
+  pthread_t *threads;
+  c_bool_t *started, ret = TRUE;
+  uint_t n, k;
+  uint64_t span;
 
   if(!a || !iter)
     return(FALSE);
-  if(a->bot < index)
+  if(index >= a->bot)
     return(TRUE);
-  dv = div(index, C_DARRAY_NBBY);
-
-  for(e = a->mem + (a->elemsz * index),
-        byp = a->free_list + dv.quot,
-        i = 0,
-        left = a->bot - index,
-        bil = C_DARRAY_NBBY - dv.rem,
-        by = *byp >> dv.rem;
-      left--;
-      i++, e += a->elemsz)
-  {
-    if(!(by & 1))
-      if(!iter(e, i, hook))
-        return(FALSE);
 
-    if(!--bil)
-      bil = C_DARRAY_NBBY, by = *(byp++);
+  span = a->bot - index;
+  n = C_min(nthreads, span / C_DARRAY_PARALLEL_MIN + 1);
+  if(n < 2)
+    return(C_darray_iterate(a, iter, index, hook));
+
+  jobs = C_newa(n, __c_darray_job_t);
+  threads = C_newa(n, pthread_t);
+  started = C_newa(n, c_bool_t);
+  if(!jobs || !threads || !started)
+  {
+    C_free(jobs);
+    C_free(threads);
+    C_free(started);
+    return(C_darray_iterate(a, iter, index, hook));
+  }
+
+  for(k = 0; k < n; k++)
+  {
+    jobs[k].a = a;
+    jobs[k].iter = iter;
+    jobs[k].hook = hook;
+    jobs[k].stop = &stop;
+    jobs[k].base = index;
+    jobs[k].lo = k ? jobs[k - 1].hi : index;
+    jobs[k].hi = (k == n - 1) ? a->bot
+      : (uint_t)(index + span * (k + 1) / n) / C_DARRAY_WORD_BITS
+      * C_DARRAY_WORD_BITS;
+    if(jobs[k].hi < jobs[k].lo)
+      jobs[k].hi = jobs[k].lo;
   }
-  
-  return(TRUE);
+
+  // the first range on this thread, those not started as well
+  for(k = 1; k < n; k++)
+    started[k] = !pthread_create(&threads[k], NULL, __C_darray_iterate_job,
+                                 &jobs[k]);
+  __C_darray_iterate_job(&jobs[0]);
+  for(k = 1; k < n; k++)
+  {
+    if(started[k])
+      pthread_join(threads[k], NULL);
+    else
+      __C_darray_iterate_job(&jobs[k]);
+  }
+
+  for(k = 0; k < n; k++)
+    ret = ret && jobs[k].ret;
+
+  C_free(jobs);
+  C_free(threads);
+  C_free(started);
+
+  return(ret);
 }
 
 /* end of darray */
 
+/* a link off the pool, refilled with a new slab when empty */
+
+static c_link_t *__C_linklist_get(c_linklist_t *l)
+{
+  c_link_t *q, *slab;
+  uint_t i;
+
+  if(!l->pool)
+  {
+    if(!(slab = C_malloc(C_LINKLIST_SLAB, c_link_t)))
+      return(NULL);
+    slab->next = l->slabs;
+    l->slabs = slab;
+    for(i = 1; i < C_LINKLIST_SLAB - 1; i++)
+      slab[i].next = &slab[i + 1];
+    slab[i].next = NULL;
+    l->pool = &slab[1];
+  }
+  q = l->pool;
+  l->pool = q->next;
+
+  return(q);
+}
+
+/*
+ */
+
+static inline void __C_linklist_put(c_linklist_t *l, c_link_t *q)
+{
+  q->next = l->pool;
+  l->pool = q;
+}
+
+/*
+ */
+
 static c_link_t *__C_linklist_unlink_r(c_linklist_t *l, c_link_t **p)
 {
   c_link_t *r;
@@ -330,6 +786,7 @@ c_linklist_t *C_linklist_create(void)
   c_linklist_t *l = C_new(c_linklist_t);
 
   l->head = l->tail = l->p = NULL;
+  l->pool = l->slabs = NULL;
   l->size = 0L;
 
   return(l);
@@ -345,14 +802,14 @@ void C_linklist_destroy(c_linklist_t *l)
   if(!l)
     return;
 
-  for(p = l->head; p;)
+  if(l->destructor)
+    for(p = l->head; p; p = p->next)
+      l->destructor(p->data);
+
+  for(p = l->slabs; p;)
   {
     q = p;
     p = p->next;
-
-    if(l->destructor)
-      l->destructor(q->data);
-    
     C_free(q);
   }
   C_free(l);
@@ -392,7 +849,8 @@ c_bool_t C_linklist_store_r(c_linklist_t *l, const void *data, c_link_t **p)
   if(!l || !data)
     return(FALSE);
 
-  q = C_new(c_link_t);
+  if(!(q = __C_linklist_get(l)))
+    return(FALSE);
   q->data = (void *)data;
 
   if(*p == l->head) /* new head? */
@@ -509,7 +967,7 @@ void *C_linklist_pop(c_linklist_t *l)
   C_linklist_move_head_r(l, &p);
   q = __C_linklist_unlink_r(l, &p);
   r = q->data;
-  C_free(q);
+  __C_linklist_put(l, q);
 
   return(r);
 }
@@ -573,8 +1031,8 @@ c_bool_t C_linklist_delete_r(c_linklist_t *l, c_link_t **p)
 
   if(l->destructor)
     l->destructor(r->data);
-  
-  C_free(r);
+
+  __C_linklist_put(l, r);
 
   return(TRUE);
 }
@@ -635,5 +1093,2209 @@ c_bool_t C_linklist_move_r(c_linklist_t *l, int where, c_link_t **p)
   return(FALSE);
 }
 
+/*
+ * iter is given the data of each link from the head, through a cursor
+ * of its own, until it returns FALSE.
+ */
+
+c_bool_t C_linklist_iterate(c_linklist_t *l,
+                            c_bool_t (*iter)(void *data, void *hook),
+                            void *hook)
+{
+  c_link_t *p;
+  void *d;
+
+  if(!l || !iter)
+    return(FALSE);
+
+  C_linklist_foreach_r(l, &p, d)
+    if(!iter(d, hook))
+      return(FALSE);
+
+  return(TRUE);
+}
+
 /* end of linklist */
 
+/* bytes mem can hold, NUL included */
+
+static inline size_t __C_dstring_room(c_dstring_t *d)
+{
+  return(d->mapped ? d->mapped : (size_t)d->blk * d->blocksz);
+}
+
+/*
+ */
+
+static inline char *__C_dstring_at(c_dstring_t *d, size_t o)
+{
+  return(d->chunks ? d->chunks[o / d->blocksz] + o % d->blocksz
+         : d->mem + o);
+}
+
+/*
+ * room for n bytes. mem grows to at least twice its blocks, moving off
+ * a file mapping to the heap; a chunked dstring only adds chunks.
+ */
+
+static c_bool_t __C_dstring_reserve(c_dstring_t *d, size_t n)
+{
+  size_t blk, k;
+  char *m, **c;
+
+  if(d->chunks)
+  {
+    blk = (n + d->blocksz - 1) / d->blocksz;
+    if(blk > d->nchunks)
+    {
+      k = (blk < (size_t)d->nchunks * 2) ? (size_t)d->nchunks * 2 : blk;
+      if(!(c = C_realloc(d->chunks, k, char *)))
+        return(FALSE);
+      d->chunks = c;
+      d->nchunks = k;
+    }
+    for(; d->blk < blk; d->blk++)
+      if(!(d->chunks[d->blk] = C_malloc(d->blocksz, char)))
+        return(FALSE);
+
+    return(TRUE);
+  }
+
+  if(n < __C_dstring_room(d))
+    return(TRUE);
+
+  blk = n / d->blocksz + 1;
+  if(blk < (size_t)d->blk * 2)
+    blk = (size_t)d->blk * 2;
+  if(d->mapped)
+  {
+    if(!(m = C_malloc(blk * d->blocksz, char)))
+      return(FALSE);
+    memcpy(m, d->mem, d->len + 1);
+    munmap(d->mem, d->mapped);
+    d->mapped = 0;
+  }
+  else if(!(m = C_realloc(d->mem, blk * d->blocksz, char)))
+    return(FALSE);
+  d->mem = m;
+  d->blk = blk;
+
+  return(TRUE);
+}
+
+/*
+ */
+
+c_dstring_t *C_dstring_create(uint_t blocksz)
+{
+  c_dstring_t *d;
+
+  if(blocksz < C_DSTRING_MIN_BLOCKSZ)
+    return(NULL);
+
+  if(!(d = C_new(c_dstring_t)))
+    return(NULL);
+  if(!(d->mem = C_malloc(blocksz, char)))
+  {
+    C_free(d);
+    return(NULL);
+  }
+  *(d->mem) = NUL;
+  d->blk = 1;
+  d->blocksz = blocksz;
+  d->p = d->len = 0;
+
+  return(d);
+}
+
+/*
+ * for large or long lived buffers: growing never copies, but the bytes
+ * are only reachable a chunk at a time, through C_dstring_chunk().
+ */
+
+c_dstring_t *C_dstring_create_chunked(uint_t blocksz)
+{
+  c_dstring_t *d;
+
+  if(blocksz < C_DSTRING_MIN_BLOCKSZ)
+    return(NULL);
+
+  if(!(d = C_new(c_dstring_t)))
+    return(NULL);
+  d->nchunks = 8;
+  if(!(d->chunks = C_newa(d->nchunks, char *)))
+  {
+    C_free(d);
+    return(NULL);
+  }
+  d->blk = 0;
+  d->blocksz = blocksz;
+  d->p = d->len = 0;
+
+  return(d);
+}
+
+/*
+ * the bytes are handed over as a NUL-terminated string of the heap.
+ */
+
+char *C_dstring_destroy(c_dstring_t *d)
+{
+  char *s, *c;
+  size_t n, o;
+  uint_t i;
+
+  if(!d)
+    return(NULL);
+
+  if(d->chunks || d->mapped)
+  {
+    if((s = C_malloc(d->len + 1, char)))
+    {
+      for(i = 0, o = 0; (c = C_dstring_chunk(d, i, &n)); i++, o += n)
+        memcpy(s + o, c, n);
+      s[d->len] = NUL;
+    }
+    if(d->chunks)
+    {
+      for(i = 0; i < d->blk; i++)
+        C_free(d->chunks[i]);
+      C_free(d->chunks);
+    }
+    else
+      munmap(d->mem, d->mapped);
+  }
+  else if(!(s = C_realloc(d->mem, d->len + 1, char)))
+    s = d->mem;
+  C_free(d);
+
+  return(s);
+}
+
+/*
+ */
+
+c_bool_t C_dstring_putc(c_dstring_t *d, char c)
+{
+  if(!d)
+    return(FALSE);
+
+  if(d->chunks || (size_t)d->p + 1 >= __C_dstring_room(d))
+    return(C_dstring_puts_len(d, &c, 1));
+
+  d->mem[d->p++] = c;
+  if(d->p > d->len)
+    d->mem[++(d->len)] = NUL;
+
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_dstring_puts(c_dstring_t *d, const char *s)
+{
+  if(!d || !s)
+    return(FALSE);
+
+  return(C_dstring_puts_len(d, s, strlen(s)));
+}
+
+/*
+ * written at the position, over what is there and on past the end.
+ */
+
+c_bool_t C_dstring_puts_len(c_dstring_t *d, const char *s, size_t len)
+{
+  size_t o, n, end;
+
+  if(!d || !s)
+    return(FALSE);
+
+  end = d->p + len;
+  if(!__C_dstring_reserve(d, end))
+    return(FALSE);
+
+  if(d->chunks)
+  {
+    for(o = d->p; o < end; o += n, s += n)
+    {
+      n = d->blocksz - o % d->blocksz;
+      if(n > end - o)
+        n = end - o;
+      memcpy(__C_dstring_at(d, o), s, n);
+    }
+  }
+  else
+    memcpy(d->mem + d->p, s, len);
+
+  d->p = end;
+  if(d->p > d->len)
+  {
+    d->len = d->p;
+    if(!d->chunks)
+      d->mem[d->len] = NUL;
+  }
+
+  return(TRUE);
+}
+
+/*
+ */
+
+char C_dstring_getc(c_dstring_t *d)
+{
+  if(!d)
+    return(NUL);
+  if(d->p >= d->len)
+    return(NUL);
+
+  return(*__C_dstring_at(d, d->p++));
+}
+
+/*
+ * like fgets(): up to len - 1 bytes, up to and including termin. the
+ * terminator is looked for with memchr(), a chunk at a time.
+ */
+
+char *C_dstring_gets(c_dstring_t *d, char *s, size_t len, char termin)
+{
+  size_t n, k, want;
+  char *q, *t;
+
+  if(!d || !s || !len)
+    return(NULL);
+  if(d->p >= d->len)
+    return(NULL);
+
+  want = d->len - d->p;
+  if(want > len - 1)
+    want = len - 1;
+
+  for(n = 0; n < want; n += k)
+  {
+    q = __C_dstring_at(d, d->p + n);
+    k = want - n;
+    if(d->chunks && k > d->blocksz - (d->p + n) % d->blocksz)
+      k = d->blocksz - (d->p + n) % d->blocksz;
+    if((t = memchr(q, termin, k)))
+    {
+      k = t - q + 1;
+      memcpy(s + n, q, k);
+      n += k;
+      break;
+    }
+    memcpy(s + n, q, k);
+  }
+  s[n] = NUL;
+  d->p += n;
+
+  return(s);
+}
+
+/*
+ */
+
+c_bool_t C_dstring_seek(c_dstring_t *d, off_t where, int whence)
+{
+  off_t o;
+
+  if(!d)
+    return(FALSE);
+
+  switch(whence)
+  {
+    case C_DSTRING_SEEK_ABS:
+      o = where;
+      break;
+
+    case C_DSTRING_SEEK_REL:
+      o = d->p + where;
+      break;
+
+    case C_DSTRING_SEEK_END:
+      o = d->len + where;
+      break;
+
+    default:
+      return(FALSE);
+  }
+
+  if(o < 0 || o > d->len)
+    return(FALSE);
+  d->p = o;
+
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_dstring_trunc(c_dstring_t *d, off_t length)
+{
+  if(!d)
+    return(FALSE);
+  if(length < 0 || length > d->len)
+    return(FALSE);
+
+  d->len = length;
+  if(d->p > d->len)
+    d->p = d->len;
+  if(!d->chunks)
+    d->mem[d->len] = NUL;
+
+  return(TRUE);
+}
+
+/*
+ * the file is mapped copy-on-write rather than read, over anonymous
+ * pages that keep it NUL-terminated; it must not shrink meanwhile.
+ */
+
+c_dstring_t *C_dstring_load(const char *path, uint_t blocksz)
+{
+  c_dstring_t *d;
+  struct stat st;
+  size_t room;
+  long pg;
+  char *m;
+  int fd;
+
+  if(!path || blocksz < C_DSTRING_MIN_BLOCKSZ)
+    return(NULL);
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(NULL);
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return(NULL);
+  }
+  if(!st.st_size)
+  {
+    close(fd);
+    return(C_dstring_create(blocksz));
+  }
+
+  pg = sysconf(_SC_PAGESIZE);
+  room = ((size_t)st.st_size + pg) / pg * pg;
+  m = mmap(NULL, room, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(m == MAP_FAILED)
+  {
+    close(fd);
+    return(NULL);
+  }
+  if(mmap(m, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED
+     || !(d = C_new(c_dstring_t)))
+  {
+    munmap(m, room);
+    close(fd);
+    return(NULL);
+  }
+  close(fd);
+
+  d->mem = m;
+  d->mapped = room;
+  d->blocksz = blocksz;
+  d->blk = room / blocksz;
+  d->p = 0;
+  d->len = st.st_size;
+
+  return(d);
+}
+
+/*
+ * written aside then renamed over path, which may be mapped by the
+ * dstring itself.
+ */
+
+c_bool_t C_dstring_save(c_dstring_t *d, const char *path)
+{
+  FILE *fp;
+  char *tmp, *c;
+  size_t n;
+  uint_t i;
+
+  if(!d || !path)
+    return(FALSE);
+  if(!*path)
+    return(FALSE);
+
+  if(!(tmp = C_newstr(strlen(path) + 4)))
+    return(FALSE);
+  sprintf(tmp, "%s.tmp", path);
+  if(!(fp = fopen(tmp, "w")))
+  {
+    C_free(tmp);
+    return(FALSE);
+  }
+
+  for(i = 0; (c = C_dstring_chunk(d, i, &n)); i++)
+    if(fwrite(c, (size_t)1, n, fp) != n)
+      break;
+
+  if(c || fclose(fp) || rename(tmp, path))
+  {
+    if(c)
+      fclose(fp);
+    unlink(tmp);
+    C_free(tmp);
+    return(FALSE);
+  }
+
+  C_free(tmp);
+  return(TRUE);
+}
+
+/*
+ * the bytes in one piece, valid until the next write; NULL for a
+ * chunked dstring.
+ */
+
+char *C_dstring_data(c_dstring_t *d)
+{
+  if(!d)
+    return(NULL);
+
+  return(d->chunks ? NULL : d->mem);
+}
+
+/*
+ * the bytes of chunk i and their count, NULL past the end. a dstring
+ * that is not chunked has all of them in chunk 0.
+ */
+
+char *C_dstring_chunk(c_dstring_t *d, uint_t i, size_t *len)
+{
+  size_t o;
+
+  if(!d || !len)
+    return(NULL);
+
+  if(!d->chunks)
+  {
+    if(i || !d->len)
+      return(NULL);
+    *len = d->len;
+    return(d->mem);
+  }
+
+  o = (size_t)i * d->blocksz;
+  if(o >= (size_t)d->len)
+    return(NULL);
+  *len = ((size_t)d->len - o < d->blocksz) ? (size_t)d->len - o : d->blocksz;
+
+  return(d->chunks[i]);
+}
+
+/* end of dstring */
+
+
+static uint_t (*__C_hashtable_hashfunc)(const char *s, uint_t modulo) = NULL;
+
+#define C_HASHTABLE_H7(H) ((c_byte_t)((H) >> 25))
+#define C_HASHTABLE_ISFREE(C) ((C) & 0x80)
+
+/* bit i set for each control byte i of the group at g equal to c */
+
+static inline uint_t __C_hashtable_match(const c_byte_t *g, c_byte_t c)
+{
+#ifdef __SSE2__
+  return((uint_t)_mm_movemask_epi8(
+           _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)g),
+                          _mm_set1_epi8((char)c))));
+#else
+  uint_t i, m = 0;
+
+  for(i = 0; i < C_HASHTABLE_GROUP; i++)
+    m |= (uint_t)(g[i] == c) << i;
+  return(m);
+#endif
+}
+
+/* same for empty or deleted buckets, the ones with the high bit set */
+
+static inline uint_t __C_hashtable_match_free(const c_byte_t *g)
+{
+#ifdef __SSE2__
+  return((uint_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g)));
+#else
+  uint_t i, m = 0;
+
+  for(i = 0; i < C_HASHTABLE_GROUP; i++)
+    m |= (uint_t)(g[i] >> 7) << i;
+  return(m);
+#endif
+}
+
+/* FNV-1a or the function set, mixed for both ends of it to be usable */
+
+static uint_t __C_hashtable_hash(const char *key)
+{
+  uint_t h;
+
+  if(__C_hashtable_hashfunc)
+    h = __C_hashtable_hashfunc(key, UINT_MAX);
+  else
+    for(h = 2166136261U; *key; key++)
+      h = (h ^ (c_byte_t)*key) * 16777619U;
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6BU;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35U;
+  h ^= h >> 16;
+
+  return(h);
+}
+
+/*
+ */
+
+static c_bool_t __C_hashslots_init(c_hashslots_t *s, uint_t buckets)
+{
+  s->ctrl = C_malloc(buckets, c_byte_t);
+  s->entries = C_malloc(buckets, c_hashentry_t);
+  if(!s->ctrl || !s->entries)
+  {
+    C_free(s->ctrl);
+    C_free(s->entries);
+    return(FALSE);
+  }
+  memset((void *)s->ctrl, C_HASHTABLE_EMPTY, buckets);
+  s->buckets = buckets;
+  s->used = 0;
+
+  return(TRUE);
+}
+
+/*
+ * groups are probed by triangular steps, which visit each of them
+ * once for a power of 2. there is always an empty bucket to end a
+ * probe, tables are grown at 7/8 of buckets used.
+ */
+
+static c_hashentry_t *__C_hashslots_find(c_hashslots_t *s, const char *key,
+                                         uint_t hash)
+{
+  uint_t g, i, m, step, mask;
+  c_byte_t *ctrl;
+
+  if(!s->buckets)
+    return(NULL);
+
+  mask = s->buckets / C_HASHTABLE_GROUP - 1;
+  for(g = hash & mask, step = 0; step <= mask; g = (g + ++step) & mask)
+  {
+    ctrl = s->ctrl + g * C_HASHTABLE_GROUP;
+    for(m = __C_hashtable_match(ctrl, C_HASHTABLE_H7(hash)); m; m &= m - 1)
+    {
+      i = g * C_HASHTABLE_GROUP + __builtin_ctz(m);
+      if(s->entries[i].hash == hash && !strcmp(s->entries[i].tag.key, key))
+        return(&s->entries[i]);
+    }
+    if(__C_hashtable_match(ctrl, C_HASHTABLE_EMPTY))
+      break;
+  }
+
+  return(NULL);
+}
+
+/*
+ */
+
+static c_hashentry_t *__C_hashslots_insert(c_hashslots_t *s, uint_t hash)
+{
+  uint_t g, i, m, step, mask;
+
+  mask = s->buckets / C_HASHTABLE_GROUP - 1;
+  for(g = hash & mask, step = 0; ; g = (g + ++step) & mask)
+  {
+    if((m = __C_hashtable_match_free(s->ctrl + g * C_HASHTABLE_GROUP)))
+    {
+      i = g * C_HASHTABLE_GROUP + __builtin_ctz(m);
+      if(s->ctrl[i] == C_HASHTABLE_EMPTY)
+        s->used++;
+      s->ctrl[i] = C_HASHTABLE_H7(hash);
+      s->entries[i].hash = hash;
+      return(&s->entries[i]);
+    }
+  }
+}
+
+/*
+ */
+
+static void __C_hashslots_free(c_hashslots_t *s, void (*destructor)(void *))
+{
+  uint_t i;
+
+  for(i = 0; i < s->buckets; i++)
+  {
+    if(C_HASHTABLE_ISFREE(s->ctrl[i]))
+      continue;
+    if(destructor)
+      destructor(s->entries[i].tag.data);
+    C_free(s->entries[i].tag.key);
+  }
+  C_free(s->ctrl);
+  C_free(s->entries);
+  C_zero(s, c_hashslots_t);
+}
+
+/*
+ * move up to n buckets of the old table to the current one, leaving
+ * them deleted for probes through the old table to go on.
+ */
+
+static void __C_hashtable_migrate(c_hashtable_t *h, uint_t n)
+{
+  c_hashentry_t *e;
+  uint_t i;
+
+  for(; n && h->migrated < h->old.buckets; n--, h->migrated++)
+  {
+    i = h->migrated;
+    if(C_HASHTABLE_ISFREE(h->old.ctrl[i]))
+      continue;
+    e = __C_hashslots_insert(&h->cur, h->old.entries[i].hash);
+    e->tag = h->old.entries[i].tag;
+    h->old.ctrl[i] = C_HASHTABLE_DELETED;
+  }
+
+  if(h->old.buckets && h->migrated == h->old.buckets)
+  {
+    __C_hashslots_free(&h->old, NULL);
+    h->migrated = 0;
+  }
+}
+
+/*
+ * a table twice as large, or as large to drop deleted entries, which
+ * the entries are then migrated to.
+ */
+
+static c_bool_t __C_hashtable_grow(c_hashtable_t *h)
+{
+  c_hashslots_t s;
+  uint_t buckets = h->cur.buckets;
+
+  if(h->old.buckets)
+    __C_hashtable_migrate(h, h->old.buckets);
+
+  if(h->size >= buckets / 2)
+  {
+    if(buckets > UINT_MAX / 2)
+      return(FALSE);
+    buckets *= 2;
+  }
+  if(!__C_hashslots_init(&s, buckets))
+    return(FALSE);
+
+  h->old = h->cur;
+  h->cur = s;
+  h->migrated = 0;
+
+  return(TRUE);
+}
+
+/*
+ */
+
+static c_hashentry_t *__C_hashtable_find(c_hashtable_t *h, const char *key,
+                                         uint_t hash, c_hashslots_t **s)
+{
+  c_hashentry_t *e;
+
+  if((e = __C_hashslots_find(&h->cur, key, hash)))
+  {
+    *s = &h->cur;
+    return(e);
+  }
+  if((e = __C_hashslots_find(&h->old, key, hash)))
+  {
+    *s = &h->old;
+    return(e);
+  }
+
+  return(NULL);
+}
+
+/*
+ */
+
+c_hashtable_t *C_hashtable_create(uint_t buckets)
+{
+  c_hashtable_t *h;
+  uint_t n;
+
+  if(buckets > UINT_MAX / 2 + 1)
+    return(NULL);
+  for(n = C_HASHTABLE_MIN_BUCKETS; n < buckets; n <<= 1);
+
+  if(!(h = C_new(c_hashtable_t)))
+    return(NULL);
+  if(!__C_hashslots_init(&h->cur, n))
+  {
+    C_free(h);
+    return(NULL);
+  }
+
+  return(h);
+}
+
+/*
+ */
+
+void C_hashtable_destroy(c_hashtable_t *h)
+{
+  if(!h)
+    return;
+
+  __C_hashslots_free(&h->cur, h->destructor);
+  __C_hashslots_free(&h->old, h->destructor);
+  C_free(h);
+}
+
+/*
+ */
+
+c_bool_t C_hashtable_set_destructor(c_hashtable_t *h,
+                                    void (*destructor)(void *))
+{
+  if(!h)
+    return(FALSE);
+
+  h->destructor = destructor;
+  return(TRUE);
+}
+
+/*
+ * the function is given UINT_MAX as modulo, and is shared by all
+ * tables: set it before creating any.
+ */
+
+c_bool_t C_hashtable_set_hashfunc(uint_t (*func)(const char *s,
+                                                 uint_t modulo))
+{
+  __C_hashtable_hashfunc = func;
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_hashtable_store(c_hashtable_t *h, const char *key,
+                           const void *data)
+{
+  c_hashslots_t *s;
+  c_hashentry_t *e;
+  uint_t hash;
+  char *k;
+
+  if(!h || !key)
+    return(FALSE);
+
+  hash = __C_hashtable_hash(key);
+  __C_hashtable_migrate(h, C_HASHTABLE_MIGRATE);
+
+  if((e = __C_hashtable_find(h, key, hash, &s)))
+  {
+    if(h->destructor && e->tag.data != data)
+      h->destructor(e->tag.data);
+    e->tag.data = (void *)data;
+    return(TRUE);
+  }
+
+  if(h->cur.used >= h->cur.buckets / 8 * 7)
+    if(!__C_hashtable_grow(h))
+      return(FALSE);
+  if(!(k = C_newstr(strlen(key))))
+    return(FALSE);
+
+  e = __C_hashslots_insert(&h->cur, hash);
+  e->tag.key = strcpy(k, key);
+  e->tag.data = (void *)data;
+  h->size++;
+
+  return(TRUE);
+}
+
+/*
+ */
+
+void *C_hashtable_restore(c_hashtable_t *h, const char *key)
+{
+  c_hashslots_t *s;
+  c_hashentry_t *e;
+
+  if(!h || !key)
+    return(NULL);
+
+  e = __C_hashtable_find(h, key, __C_hashtable_hash(key), &s);
+  return(e ? e->tag.data : NULL);
+}
+
+/*
+ */
+
+c_bool_t C_hashtable_delete(c_hashtable_t *h, const char *key)
+{
+  c_hashslots_t *s;
+  c_hashentry_t *e;
+
+  if(!h || !key)
+    return(FALSE);
+
+  __C_hashtable_migrate(h, C_HASHTABLE_MIGRATE);
+  if(!(e = __C_hashtable_find(h, key, __C_hashtable_hash(key), &s)))
+    return(FALSE);
+
+  s->ctrl[e - s->entries] = C_HASHTABLE_DELETED;
+  if(h->destructor)
+    h->destructor(e->tag.data);
+  C_free(e->tag.key);
+  h->size--;
+
+  return(TRUE);
+}
+
+/*
+ * the keys are the table's own, valid until it changes. the array is
+ * NULL terminated, to free with C_free().
+ */
+
+char **C_hashtable_keys(c_hashtable_t *h, size_t *len)
+{
+  c_hashslots_t *s[2];
+  char **v, **p;
+  uint_t i, j;
+
+  if(!h)
+    return(NULL);
+  if(!(v = p = C_newa(h->size + 1, char *)))
+    return(NULL);
+
+  s[0] = &h->cur, s[1] = &h->old;
+  for(j = 0; j < 2; j++)
+    for(i = 0; i < s[j]->buckets; i++)
+      if(!C_HASHTABLE_ISFREE(s[j]->ctrl[i]))
+        *(p++) = s[j]->entries[i].tag.key;
+  *p = NULL;
+
+  if(len)
+    *len = h->size;
+  return(v);
+}
+
+/* end of hashtable */
+
+/*
+ * a thread has a record while it uses the epochs, active with the
+ * epoch it pinned at in the low bit cleared, 0 when not pinned. the
+ * epoch moves on by 2 once every active record has seen it; what was
+ * retired at epoch e is freed from e + 4 on. records outlive their
+ * thread, to be taken by the next one.
+ */
+
+#define C_EPOCH_ACTIVE 1UL
+#define C_EPOCH_GRACE 4UL
+#define C_EPOCH_BATCH 64
+
+typedef struct __c_epoch_item_t
+{
+  struct __c_epoch_item_t *next;
+  unsigned long epoch;
+  void (*func)(void *);
+  void *p;
+} __c_epoch_item_t;
+
+typedef struct __c_epoch_rec_t
+{
+  unsigned long local;
+  uint_t nest;
+  uint_t retired;               /* since the last advance */
+  int owned;
+  pthread_mutex_t mutex;        /* of limbo */
+  __c_epoch_item_t *limbo;      /* latest first */
+  struct __c_epoch_rec_t *next;
+} __c_epoch_rec_t;
+
+static unsigned long __C_epoch = 2;
+static __c_epoch_rec_t *__C_epoch_recs = NULL;
+static pthread_key_t __C_epoch_key;
+static pthread_once_t __C_epoch_once = PTHREAD_ONCE_INIT;
+static __thread __c_epoch_rec_t *__C_epoch_self = NULL;
+
+/*
+ */
+
+static void __C_epoch_release(void *p)
+{
+  __c_epoch_rec_t *r = (__c_epoch_rec_t *)p;
+
+  r->nest = 0;
+  __atomic_store_n(&r->local, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ */
+
+static void __C_epoch_init(void)
+{
+  pthread_key_create(&__C_epoch_key, __C_epoch_release);
+}
+
+/* the record of the calling thread, a free one or a new one */
+
+static __c_epoch_rec_t *__C_epoch_rec(void)
+{
+  __c_epoch_rec_t *r;
+  int free;
+
+  if(__C_epoch_self)
+    return(__C_epoch_self);
+
+  pthread_once(&__C_epoch_once, __C_epoch_init);
+  for(r = __atomic_load_n(&__C_epoch_recs, __ATOMIC_ACQUIRE); r; r = r->next)
+  {
+    free = 0;
+    if(__atomic_compare_exchange_n(&r->owned, &free, 1, FALSE,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if(!r)
+  {
+    if(!(r = C_new(__c_epoch_rec_t)))
+      abort();
+    r->owned = 1;
+    pthread_mutex_init(&r->mutex, NULL);
+    r->next = __atomic_load_n(&__C_epoch_recs, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&__C_epoch_recs, &r->next, r, TRUE,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+  pthread_setspecific(__C_epoch_key, r);
+
+  return(__C_epoch_self = r);
+}
+
+/* to the next epoch, if every pinned thread is in this one */
+
+static c_bool_t __C_epoch_advance(void)
+{
+  __c_epoch_rec_t *r;
+  unsigned long e, l;
+
+  e = __atomic_load_n(&__C_epoch, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for(r = __atomic_load_n(&__C_epoch_recs, __ATOMIC_ACQUIRE); r; r = r->next)
+  {
+    l = __atomic_load_n(&r->local, __ATOMIC_ACQUIRE);
+    if((l & C_EPOCH_ACTIVE) && (l & ~C_EPOCH_ACTIVE) != e)
+      return(FALSE);
+  }
+
+  return(__atomic_compare_exchange_n(&__C_epoch, &e, e + 2, FALSE,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+/* what no thread can reach any more, from every record */
+
+static void __C_epoch_collect(c_bool_t wait)
+{
+  __c_epoch_rec_t *r;
+  __c_epoch_item_t *i, **pi, *q;
+  unsigned long e;
+
+  e = __atomic_load_n(&__C_epoch, __ATOMIC_ACQUIRE);
+  for(r = __atomic_load_n(&__C_epoch_recs, __ATOMIC_ACQUIRE); r; r = r->next)
+  {
+    if(wait)
+      pthread_mutex_lock(&r->mutex);
+    else if(pthread_mutex_trylock(&r->mutex))
+      continue;
+
+    for(pi = &r->limbo; *pi && (*pi)->epoch + C_EPOCH_GRACE > e;
+        pi = &(*pi)->next);
+    i = *pi;
+    *pi = NULL;
+    pthread_mutex_unlock(&r->mutex);
+
+    for(; i; i = q)
+    {
+      q = i->next;
+      i->func(i->p);
+      C_free(i);
+    }
+  }
+}
+
+/*
+ * func is called on p once no thread pinned now can still reach it.
+ */
+
+static void __C_epoch_retire(void (*func)(void *), void *p)
+{
+  __c_epoch_rec_t *r = __C_epoch_rec();
+  __c_epoch_item_t *i;
+
+  if(!(i = C_new(__c_epoch_item_t)))
+    abort();
+  i->func = func;
+  i->p = p;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  i->epoch = __atomic_load_n(&__C_epoch, __ATOMIC_ACQUIRE);
+
+  pthread_mutex_lock(&r->mutex);
+  i->next = r->limbo;
+  r->limbo = i;
+  pthread_mutex_unlock(&r->mutex);
+
+  if(++(r->retired) >= C_EPOCH_BATCH && !r->nest)
+  {
+    r->retired = 0;
+    __C_epoch_advance();
+    __C_epoch_collect(FALSE);
+  }
+}
+
+/*
+ * for callers retiring seldom but in big pieces, to have them back
+ * without waiting for C_EPOCH_BATCH retirements.
+ */
+
+static void __C_epoch_poll(void)
+{
+  __c_epoch_rec_t *r = __C_epoch_rec();
+
+  if(r->nest)
+    return;
+
+  r->retired = 0;
+  __C_epoch_advance();
+  __C_epoch_collect(FALSE);
+}
+
+/*
+ * everything retired before is freed on return. the caller must not
+ * be pinned.
+ */
+
+static void __C_epoch_synchronize(void)
+{
+  unsigned long e = __atomic_load_n(&__C_epoch, __ATOMIC_ACQUIRE);
+
+  while(__atomic_load_n(&__C_epoch, __ATOMIC_ACQUIRE) < e + C_EPOCH_GRACE)
+    if(!__C_epoch_advance())
+      sched_yield();
+  __C_epoch_collect(TRUE);
+}
+
+/*
+ */
+
+void C_epoch_pin(void)
+{
+  __c_epoch_rec_t *r = __C_epoch_rec();
+
+  if(!(r->nest)++)
+  {
+    __atomic_store_n(&r->local,
+                     __atomic_load_n(&__C_epoch, __ATOMIC_RELAXED)
+                     | C_EPOCH_ACTIVE, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+}
+
+/*
+ */
+
+void C_epoch_unpin(void)
+{
+  __c_epoch_rec_t *r = __C_epoch_rec();
+
+  if(r->nest && !--(r->nest))
+    __atomic_store_n(&r->local, 0, __ATOMIC_RELEASE);
+}
+
+/* end of epochs */
+
+static c_chashbuckets_t *__C_chashbuckets_new(uint_t buckets)
+{
+  c_chashbuckets_t *t;
+
+  if(!(t = C_new(c_chashbuckets_t)))
+    return(NULL);
+  if(!(t->heads = C_newa(buckets, c_chashnode_t *)))
+  {
+    C_free(t);
+    return(NULL);
+  }
+  t->buckets = buckets;
+
+  return(t);
+}
+
+/* a table and its nodes, not their data */
+
+static void __C_chashbuckets_free(void *p)
+{
+  c_chashbuckets_t *t = (c_chashbuckets_t *)p;
+  c_chashnode_t *n, *q;
+  uint_t i;
+
+  for(i = 0; i < t->buckets; i++)
+    for(n = t->heads[i]; n; n = q)
+    {
+      q = n->next;
+      C_free(n);
+    }
+  C_free(t->heads);
+  C_free(t);
+}
+
+/*
+ */
+
+static c_chashnode_t *__C_chashnode_new(const char *key, size_t len,
+                                        uint_t hash, const void *data)
+{
+  c_chashnode_t *n;
+
+  if(!(n = (c_chashnode_t *)malloc(sizeof(c_chashnode_t) + len + 1)))
+    return(NULL);
+  memcpy(n->key, key, len + 1);
+  n->hash = hash;
+  n->data = (void *)data;
+  n->next = NULL;
+
+  return(n);
+}
+
+/*
+ * twice the buckets, if no one grew the table since it was seen full
+ * with seen buckets. the count only ever doubles, so it tells tables
+ * apart without keeping a pointer to one that may be retired already.
+ * nodes are copied into the new chains, the old ones retired whole.
+ */
+
+static void __C_chashtable_grow(c_chashtable_t *h, uint_t seen)
+{
+  c_chashbuckets_t *t, *n = NULL;
+  c_chashnode_t *e, *c;
+  uint_t i, b;
+
+  for(i = 0; i < C_CHASHTABLE_STRIPES; i++)
+    pthread_mutex_lock(&h->stripes[i].mutex);
+
+  t = h->table;
+  if(t->buckets == seen && t->buckets <= UINT_MAX / 2
+     && C_chashtable_size(h) > (size_t)t->buckets * C_CHASHTABLE_LOAD
+     && (n = __C_chashbuckets_new(t->buckets * 2)))
+  {
+    for(i = 0; i < t->buckets && n; i++)
+      for(e = t->heads[i]; e; e = e->next)
+      {
+        if(!(c = __C_chashnode_new(e->key, strlen(e->key), e->hash,
+                                   e->data)))
+        {
+          __C_chashbuckets_free(n);
+          n = NULL;
+          break;
+        }
+        b = c->hash & (n->buckets - 1);
+        c->next = n->heads[b];
+        n->heads[b] = c;
+      }
+    if(n)
+      __atomic_store_n(&h->table, n, __ATOMIC_RELEASE);
+  }
+
+  for(i = C_CHASHTABLE_STRIPES; i-- > 0;)
+    pthread_mutex_unlock(&h->stripes[i].mutex);
+
+  if(n)
+    __C_epoch_retire(__C_chashbuckets_free, t);
+}
+
+/*
+ */
+
+c_chashtable_t *C_chashtable_create(uint_t buckets)
+{
+  c_chashtable_t *h;
+  uint_t i, n;
+
+  if(buckets > UINT_MAX / 2 + 1)
+    return(NULL);
+  for(n = C_CHASHTABLE_STRIPES; n < buckets; n <<= 1);
+
+  if(posix_memalign((void **)&h, sizeof(c_chashstripe_t),
+                    sizeof(c_chashtable_t)))
+    return(NULL);
+  memset((void *)h, 0, sizeof(c_chashtable_t));
+  if(!(h->table = __C_chashbuckets_new(n)))
+  {
+    C_free(h);
+    return(NULL);
+  }
+  for(i = 0; i < C_CHASHTABLE_STRIPES; i++)
+    pthread_mutex_init(&h->stripes[i].mutex, NULL);
+
+  return(h);
+}
+
+/*
+ * no thread may use the table any more.
+ */
+
+void C_chashtable_destroy(c_chashtable_t *h)
+{
+  c_chashnode_t *n;
+  uint_t i;
+
+  if(!h)
+    return;
+
+  __C_epoch_synchronize();
+  if(h->destructor)
+    for(i = 0; i < h->table->buckets; i++)
+      for(n = h->table->heads[i]; n; n = n->next)
+        h->destructor(n->data);
+  __C_chashbuckets_free(h->table);
+  for(i = 0; i < C_CHASHTABLE_STRIPES; i++)
+    pthread_mutex_destroy(&h->stripes[i].mutex);
+  C_free(h);
+}
+
+/*
+ */
+
+c_bool_t C_chashtable_set_destructor(c_chashtable_t *h,
+                                     void (*destructor)(void *))
+{
+  if(!h)
+    return(FALSE);
+
+  h->destructor = destructor;
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_chashtable_store(c_chashtable_t *h, const char *key,
+                            const void *data)
+{
+  pthread_mutex_t *m;
+  c_chashbuckets_t *t;
+  c_chashnode_t **pn, *n;
+  uint_t hash, buckets;
+  void *old;
+
+  if(!h || !key)
+    return(FALSE);
+
+  hash = __C_hashtable_hash(key);
+  m = &h->stripes[hash % C_CHASHTABLE_STRIPES].mutex;
+  pthread_mutex_lock(m);
+
+  t = h->table;
+  pn = &t->heads[hash & (t->buckets - 1)];
+  for(n = *pn; n; n = n->next)
+    if(n->hash == hash && !strcmp(n->key, key))
+      break;
+
+  if(n)
+  {
+    old = __atomic_exchange_n(&n->data, (void *)data, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(m);
+    if(h->destructor && old != data)
+      __C_epoch_retire(h->destructor, old);
+    return(TRUE);
+  }
+
+  if(!(n = __C_chashnode_new(key, strlen(key), hash, data)))
+  {
+    pthread_mutex_unlock(m);
+    return(FALSE);
+  }
+  n->next = *pn;
+  __atomic_store_n(pn, n, __ATOMIC_RELEASE);
+  buckets = t->buckets;
+  pthread_mutex_unlock(m);
+
+  /* t is not ours past the unlock: another grow may retire it */
+
+  if(__atomic_add_fetch(&h->size, 1, __ATOMIC_RELAXED)
+     > (size_t)buckets * C_CHASHTABLE_LOAD)
+    __C_chashtable_grow(h, buckets);
+
+  return(TRUE);
+}
+
+/*
+ * without a lock. data the table has a destructor for stays valid
+ * while the caller is pinned.
+ */
+
+void *C_chashtable_restore(c_chashtable_t *h, const char *key)
+{
+  c_chashbuckets_t *t;
+  c_chashnode_t *n;
+  uint_t hash;
+  void *data = NULL;
+
+  if(!h || !key)
+    return(NULL);
+
+  hash = __C_hashtable_hash(key);
+  C_epoch_pin();
+  t = __atomic_load_n(&h->table, __ATOMIC_ACQUIRE);
+  for(n = __atomic_load_n(&t->heads[hash & (t->buckets - 1)],
+                          __ATOMIC_ACQUIRE);
+      n; n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))
+  {
+    if(n->hash == hash && !strcmp(n->key, key))
+    {
+      data = __atomic_load_n(&n->data, __ATOMIC_ACQUIRE);
+      break;
+    }
+  }
+  C_epoch_unpin();
+
+  return(data);
+}
+
+/*
+ */
+
+c_bool_t C_chashtable_delete(c_chashtable_t *h, const char *key)
+{
+  pthread_mutex_t *m;
+  c_chashbuckets_t *t;
+  c_chashnode_t **pn, *n;
+  uint_t hash;
+
+  if(!h || !key)
+    return(FALSE);
+
+  hash = __C_hashtable_hash(key);
+  m = &h->stripes[hash % C_CHASHTABLE_STRIPES].mutex;
+  pthread_mutex_lock(m);
+
+  t = h->table;
+  for(pn = &t->heads[hash & (t->buckets - 1)]; (n = *pn); pn = &n->next)
+    if(n->hash == hash && !strcmp(n->key, key))
+      break;
+  if(!n)
+  {
+    pthread_mutex_unlock(m);
+    return(FALSE);
+  }
+  __atomic_store_n(pn, n->next, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(m);
+
+  __atomic_sub_fetch(&h->size, 1, __ATOMIC_RELAXED);
+  if(h->destructor)
+    __C_epoch_retire(h->destructor, n->data);
+  __C_epoch_retire(free, n);
+
+  return(TRUE);
+}
+
+/* end of chashtable */
+
+/* what dequeuers leave in the slots they take */
+
+static char __C_queue_taken;
+
+#define C_QUEUE_TAKEN ((void *)&__C_queue_taken)
+
+/* a segment no thread uses any more, back to the spares */
+
+static void __C_queue_recycle(void *p)
+{
+  c_queueseg_t *s = (c_queueseg_t *)p, *top;
+  c_queue_t *q = s->queue;
+
+  if(__atomic_load_n(&q->nspare, __ATOMIC_RELAXED) >= C_QUEUE_SPARE)
+  {
+    C_free(s);
+    return;
+  }
+
+  s->enq = s->deq = 0;
+  memset((void *)s->slots, 0, sizeof(s->slots));
+  __atomic_add_fetch(&q->nspare, 1, __ATOMIC_RELAXED);
+
+  top = __atomic_load_n(&q->spare, __ATOMIC_RELAXED);
+  do
+    __atomic_store_n(&s->next, top, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&q->spare, &top, s, TRUE,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * a spare or a new segment. spares are only pushed once no pinned
+ * thread can see them, so one seen on top by a pinned thread is never
+ * popped and pushed back in the meantime.
+ */
+
+static c_queueseg_t *__C_queue_segment(c_queue_t *q)
+{
+  c_queueseg_t *s, *n;
+
+  s = __atomic_load_n(&q->spare, __ATOMIC_ACQUIRE);
+  while(s)
+  {
+    n = __atomic_load_n(&s->next, __ATOMIC_RELAXED);
+    if(__atomic_compare_exchange_n(&q->spare, &s, n, TRUE,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+      __atomic_sub_fetch(&q->nspare, 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&s->next, NULL, __ATOMIC_RELAXED);
+      return(s);
+    }
+  }
+
+  if(posix_memalign((void **)&s, 64, sizeof(c_queueseg_t)))
+    return(NULL);
+  memset((void *)s, 0, sizeof(c_queueseg_t));
+  s->queue = q;
+
+  return(s);
+}
+
+/*
+ */
+
+c_queue_t *C_queue_create(void)
+{
+  c_queue_t *q;
+
+  if(posix_memalign((void **)&q, 64, sizeof(c_queue_t)))
+    return(NULL);
+  memset((void *)q, 0, sizeof(c_queue_t));
+  if(!(q->head = q->tail = __C_queue_segment(q)))
+  {
+    C_free(q);
+    return(NULL);
+  }
+
+  return(q);
+}
+
+/*
+ * no thread may use the queue any more. data still queued goes to the
+ * destructor.
+ */
+
+void C_queue_destroy(c_queue_t *q)
+{
+  c_queueseg_t *s, *n;
+  uint_t i;
+
+  if(!q)
+    return;
+
+  __C_epoch_synchronize();
+  for(s = q->head; s; s = n)
+  {
+    n = s->next;
+    for(i = 0; q->destructor && i < C_QUEUE_SEGMENT; i++)
+      if(s->slots[i] && s->slots[i] != C_QUEUE_TAKEN)
+        q->destructor(s->slots[i]);
+    C_free(s);
+  }
+  for(s = q->spare; s; s = n)
+  {
+    n = s->next;
+    C_free(s);
+  }
+  C_free(q);
+}
+
+/*
+ */
+
+c_bool_t C_queue_set_destructor(c_queue_t *q, void (*destructor)(void *))
+{
+  if(!q)
+    return(FALSE);
+
+  q->destructor = destructor;
+  return(TRUE);
+}
+
+/*
+ * a slot of the tail segment, or the first one of a new segment linked
+ * after it. retried when a dequeuer took the slot before it was
+ * written.
+ */
+
+c_bool_t C_queue_enqueue(c_queue_t *q, const void *data)
+{
+  c_queueseg_t *t, *n, *s = NULL;
+  uint_t i;
+  void *e;
+
+  if(!q || !data)
+    return(FALSE);
+
+  __atomic_add_fetch(&q->length, 1, __ATOMIC_RELAXED);
+  C_epoch_pin();
+  for(;;)
+  {
+    t = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    i = __atomic_fetch_add(&t->enq, 1, __ATOMIC_RELAXED);
+    if(i < C_QUEUE_SEGMENT)
+    {
+      e = NULL;
+      if(__atomic_compare_exchange_n(&t->slots[i], &e, (void *)data, FALSE,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        break;
+      continue;
+    }
+
+    if(t != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+      continue;
+    if((n = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)))
+    {
+      __atomic_compare_exchange_n(&q->tail, &t, n, FALSE,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if(!s && !(s = __C_queue_segment(q)))
+    {
+      C_epoch_unpin();
+      __atomic_sub_fetch(&q->length, 1, __ATOMIC_RELAXED);
+      return(FALSE);
+    }
+    s->slots[0] = (void *)data;
+    s->enq = 1;
+    if(__atomic_compare_exchange_n(&t->next, &n, s, FALSE,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+      __atomic_compare_exchange_n(&q->tail, &t, s, FALSE,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+      s = NULL;
+      break;
+    }
+    s->slots[0] = NULL;
+    s->enq = 0;
+  }
+
+  // lost the race to link it
+  if(s)
+    __C_epoch_retire(__C_queue_recycle, s);
+  C_epoch_unpin();
+
+  return(TRUE);
+}
+
+/*
+ * NULL when empty. segments are left behind once all of their slots
+ * are taken.
+ */
+
+void *C_queue_dequeue(c_queue_t *q)
+{
+  c_queueseg_t *h, *n;
+  void *data = NULL;
+  c_bool_t retired = FALSE;
+  uint_t i;
+
+  if(!q)
+    return(NULL);
+
+  C_epoch_pin();
+  for(;;)
+  {
+    h = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&h->deq, __ATOMIC_RELAXED)
+       >= __atomic_load_n(&h->enq, __ATOMIC_RELAXED)
+       && !__atomic_load_n(&h->next, __ATOMIC_ACQUIRE))
+      break;
+
+    i = __atomic_fetch_add(&h->deq, 1, __ATOMIC_RELAXED);
+    if(i < C_QUEUE_SEGMENT)
+    {
+      // an enqueuer not done with this slot tries the next one
+      if((data = __atomic_exchange_n(&h->slots[i], C_QUEUE_TAKEN,
+                                     __ATOMIC_ACQUIRE)))
+        break;
+      continue;
+    }
+
+    if(!(n = __atomic_load_n(&h->next, __ATOMIC_ACQUIRE)))
+      break;
+    if(__atomic_compare_exchange_n(&q->head, &h, n, FALSE,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+      __C_epoch_retire(__C_queue_recycle, h);
+      retired = TRUE;
+    }
+  }
+  C_epoch_unpin();
+
+  // segments are back as spares within two of these
+  if(retired)
+    __C_epoch_poll();
+
+  if(data)
+    __atomic_sub_fetch(&q->length, 1, __ATOMIC_RELAXED);
+  return(data);
+}
+
+/* end of queue */
+
+#define C_BTREE_NODE_SIZE(O)                                            \
+  (C_BTREE_LINE + ((O) + 1) * sizeof(c_id_t) + ((O) + 2) * sizeof(void *))
+#define C_BTREE_MIN(T) ((T)->order / 2)
+
+/* index of the first key not below key, branch free */
+
+static inline uint_t __C_btree_lower(const c_id_t *keys, uint_t n, c_id_t key)
+{
+  const c_id_t *base = keys;
+  uint_t half;
+
+  if(!n)
+    return(0);
+  while(n > 1)
+  {
+    half = n / 2;
+    base = (base[half] < key) ? base + half : base;
+    n -= half;
+  }
+
+  return((uint_t)(base - keys) + (*base < key));
+}
+
+/* index of the first key above key, that is of the child holding it */
+
+static inline uint_t __C_btree_upper(const c_id_t *keys, uint_t n, c_id_t key)
+{
+  const c_id_t *base = keys;
+  uint_t half;
+
+  if(!n)
+    return(0);
+  while(n > 1)
+  {
+    half = n / 2;
+    base = (base[half] <= key) ? base + half : base;
+    n -= half;
+  }
+
+  return((uint_t)(base - keys) + (*base <= key));
+}
+
+/*
+ */
+
+static c_btree_node_t *__C_btree_node(c_btree_t *tree, c_bool_t leaf)
+{
+  c_btree_node_t *n;
+  void **p;
+
+  if(posix_memalign((void **)&n, C_BTREE_LINE, C_BTREE_NODE_SIZE(tree->order)))
+    return(NULL);
+
+  n->count = 0;
+  n->leaf = leaf;
+  n->keys = (c_id_t *)((char *)n + C_BTREE_LINE);
+  p = (void **)(n->keys + tree->order + 1);
+  n->children = leaf ? NULL : (c_btree_node_t **)p;
+  n->values = leaf ? p : NULL;
+  n->next = NULL;
+
+  return(n);
+}
+
+/*
+ */
+
+static void __C_btree_node_free(c_btree_t *tree, c_btree_node_t *n)
+{
+  uint_t i;
+
+  if(n->leaf)
+  {
+    if(tree->destructor)
+      for(i = 0; i < n->count; i++)
+        tree->destructor(n->values[i]);
+  }
+  else
+  {
+    for(i = 0; i <= n->count; i++)
+      __C_btree_node_free(tree, n->children[i]);
+  }
+  C_free(n);
+}
+
+/* key with its value, or with the child right of it */
+
+static void __C_btree_insert_at(c_btree_node_t *n, uint_t i, c_id_t key,
+                                void *p)
+{
+  memmove(n->keys + i + 1, n->keys + i, (n->count - i) * sizeof(c_id_t));
+  n->keys[i] = key;
+  if(n->leaf)
+  {
+    memmove(n->values + i + 1, n->values + i, (n->count - i) * sizeof(void *));
+    n->values[i] = p;
+  }
+  else
+  {
+    memmove(n->children + i + 2, n->children + i + 1,
+            (n->count - i) * sizeof(void *));
+    n->children[i + 1] = p;
+  }
+  n->count++;
+}
+
+/*
+ * move the upper half of an overfull node n to r, and return the key
+ * separating them in the parent.
+ */
+
+static c_id_t __C_btree_split(c_btree_node_t *n, c_btree_node_t *r)
+{
+  uint_t h = n->count / 2;
+  c_id_t sep;
+
+  if(n->leaf)
+  {
+    r->count = n->count - h;
+    memcpy(r->keys, n->keys + h, r->count * sizeof(c_id_t));
+    memcpy(r->values, n->values + h, r->count * sizeof(void *));
+    r->next = n->next;
+    n->next = r;
+    sep = r->keys[0];
+  }
+  else
+  {
+    sep = n->keys[h];
+    r->count = n->count - h - 1;
+    memcpy(r->keys, n->keys + h + 1, r->count * sizeof(c_id_t));
+    memcpy(r->children, n->children + h + 1, (r->count + 1) * sizeof(void *));
+  }
+  n->count = h;
+
+  return(sep);
+}
+
+/* move the last entry of children[s] over to children[s + 1] */
+
+static void __C_btree_shift_right(c_btree_node_t *p, uint_t s)
+{
+  c_btree_node_t *l = p->children[s], *r = p->children[s + 1];
+
+  if(r->leaf)
+  {
+    __C_btree_insert_at(r, 0, l->keys[l->count - 1], l->values[l->count - 1]);
+    p->keys[s] = r->keys[0];
+  }
+  else
+  {
+    memmove(r->keys + 1, r->keys, r->count * sizeof(c_id_t));
+    memmove(r->children + 1, r->children, (r->count + 1) * sizeof(void *));
+    r->keys[0] = p->keys[s];
+    r->children[0] = l->children[l->count];
+    r->count++;
+    p->keys[s] = l->keys[l->count - 1];
+  }
+  l->count--;
+}
+
+/* move the first entry of children[s + 1] over to children[s] */
+
+static void __C_btree_shift_left(c_btree_node_t *p, uint_t s)
+{
+  c_btree_node_t *l = p->children[s], *r = p->children[s + 1];
+
+  if(r->leaf)
+  {
+    l->keys[l->count] = r->keys[0];
+    l->values[l->count] = r->values[0];
+    memmove(r->values, r->values + 1, (r->count - 1) * sizeof(void *));
+    p->keys[s] = r->keys[1];
+  }
+  else
+  {
+    l->keys[l->count] = p->keys[s];
+    l->children[l->count + 1] = r->children[0];
+    memmove(r->children, r->children + 1, r->count * sizeof(void *));
+    p->keys[s] = r->keys[0];
+  }
+  memmove(r->keys, r->keys + 1, (r->count - 1) * sizeof(c_id_t));
+  l->count++;
+  r->count--;
+}
+
+/* merge children[s + 1] into children[s] */
+
+static void __C_btree_merge(c_btree_node_t *p, uint_t s)
+{
+  c_btree_node_t *l = p->children[s], *r = p->children[s + 1];
+
+  if(l->leaf)
+  {
+    memcpy(l->keys + l->count, r->keys, r->count * sizeof(c_id_t));
+    memcpy(l->values + l->count, r->values, r->count * sizeof(void *));
+    l->count += r->count;
+    l->next = r->next;
+  }
+  else
+  {
+    l->keys[l->count] = p->keys[s];
+    memcpy(l->keys + l->count + 1, r->keys, r->count * sizeof(c_id_t));
+    memcpy(l->children + l->count + 1, r->children,
+           (r->count + 1) * sizeof(void *));
+    l->count += r->count + 1;
+  }
+  C_free(r);
+
+  memmove(p->keys + s, p->keys + s + 1, (p->count - s - 1) * sizeof(c_id_t));
+  memmove(p->children + s + 1, p->children + s + 2,
+          (p->count - s - 1) * sizeof(void *));
+  p->count--;
+}
+
+/*
+ */
+
+c_btree_t *C_btree_create(uint_t order)
+{
+  c_btree_t *tree;
+
+  if(!order)
+    order = C_BTREE_DEFAULT_ORDER;
+  if(order > C_BTREE_MAX_ORDER)
+    return(NULL);
+
+  if(!(tree = C_new(c_btree_t)))
+    return(NULL);
+  tree->order = (order / C_BTREE_LINE_KEYS + 1) * C_BTREE_LINE_KEYS - 1;
+  if(!(tree->root = tree->first = __C_btree_node(tree, TRUE)))
+  {
+    C_free(tree);
+    return(NULL);
+  }
+
+  return(tree);
+}
+
+/*
+ */
+
+void C_btree_destroy(c_btree_t *tree)
+{
+  if(!tree)
+    return;
+
+  __C_btree_node_free(tree, tree->root);
+  C_free(tree);
+}
+
+/*
+ */
+
+c_bool_t C_btree_set_destructor(c_btree_t *tree, void (*destructor)(void *))
+{
+  if(!tree)
+    return(FALSE);
+
+  tree->destructor = destructor;
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_btree_store(c_btree_t *tree, c_id_t key, const void *data)
+{
+  c_btree_node_t *path[C_BTREE_MAX_DEPTH], *spare[C_BTREE_MAX_DEPTH + 1];
+  c_btree_node_t *n, *r;
+  uint_t idx[C_BTREE_MAX_DEPTH], d, depth, i, need;
+  c_id_t sep;
+
+  if(!tree || !data)
+    return(FALSE);
+
+  for(d = 0, n = tree->root; !n->leaf; d++)
+  {
+    path[d] = n;
+    idx[d] = __C_btree_upper(n->keys, n->count, key);
+    n = n->children[idx[d]];
+  }
+  depth = d;
+
+  i = __C_btree_lower(n->keys, n->count, key);
+  if(i < n->count && n->keys[i] == key)
+  {
+    if(tree->destructor && n->values[i] != data)
+      tree->destructor(n->values[i]);
+    n->values[i] = (void *)data;
+    return(TRUE);
+  }
+
+  // nodes for the splits to come, and maybe a new root, beforehand
+  for(need = 0; need <= d && (need ? path[d - need] : n)->count == tree->order;
+      need++);
+  if(need > d)
+    need++;
+  for(d = 0; d < need; d++)
+  {
+    if(!(spare[d] = __C_btree_node(tree, !d)))
+    {
+      while(d--)
+        C_free(spare[d]);
+      return(FALSE);
+    }
+  }
+  d = depth;
+
+  __C_btree_insert_at(n, i, key, (void *)data);
+  tree->nkeys++;
+
+  for(need = 0; n->count > tree->order; need++)
+  {
+    r = spare[need];
+    sep = __C_btree_split(n, r);
+    if(!d)
+    {
+      tree->root = spare[need + 1];
+      tree->root->count = 1;
+      tree->root->keys[0] = sep;
+      tree->root->children[0] = n;
+      tree->root->children[1] = r;
+      break;
+    }
+    n = path[--d];
+    __C_btree_insert_at(n, idx[d], sep, r);
+  }
+
+  return(TRUE);
+}
+
+/*
+ */
+
+void *C_btree_restore(c_btree_t *tree, c_id_t key)
+{
+  c_btree_node_t *n;
+  uint_t i;
+
+  if(!tree)
+    return(NULL);
+
+  for(n = tree->root; !n->leaf;)
+    n = n->children[__C_btree_upper(n->keys, n->count, key)];
+
+  i = __C_btree_lower(n->keys, n->count, key);
+  return((i < n->count && n->keys[i] == key) ? n->values[i] : NULL);
+}
+
+/*
+ * nodes below half full borrow from a sibling, or are merged with it.
+ * separators left in inner nodes still route correctly.
+ */
+
+c_bool_t C_btree_delete(c_btree_t *tree, c_id_t key)
+{
+  c_btree_node_t *path[C_BTREE_MAX_DEPTH], *n, *p;
+  uint_t idx[C_BTREE_MAX_DEPTH], d, i;
+
+  if(!tree)
+    return(FALSE);
+
+  for(d = 0, n = tree->root; !n->leaf; d++)
+  {
+    path[d] = n;
+    idx[d] = __C_btree_upper(n->keys, n->count, key);
+    n = n->children[idx[d]];
+  }
+
+  i = __C_btree_lower(n->keys, n->count, key);
+  if(i == n->count || n->keys[i] != key)
+    return(FALSE);
+
+  if(tree->destructor)
+    tree->destructor(n->values[i]);
+  memmove(n->keys + i, n->keys + i + 1, (n->count - i - 1) * sizeof(c_id_t));
+  memmove(n->values + i, n->values + i + 1, (n->count - i - 1) * sizeof(void *));
+  n->count--;
+  tree->nkeys--;
+
+  while(d && n->count < C_BTREE_MIN(tree))
+  {
+    p = path[--d];
+    i = idx[d];
+    if(i > 0 && p->children[i - 1]->count > C_BTREE_MIN(tree))
+      __C_btree_shift_right(p, i - 1);
+    else if(i < p->count && p->children[i + 1]->count > C_BTREE_MIN(tree))
+      __C_btree_shift_left(p, i);
+    else
+      __C_btree_merge(p, i > 0 ? i - 1 : i);
+    n = p;
+  }
+
+  if(!tree->root->leaf && !tree->root->count)
+  {
+    n = tree->root;
+    tree->root = n->children[0];
+    C_free(n);
+  }
+
+  return(TRUE);
+}
+
+/*
+ */
+
+c_bool_t C_btree_iterate(c_btree_t *btree,
+                         c_bool_t (*consumer)(void *elem, void *hook),
+                         void *hook)
+{
+  c_btree_node_t *n;
+  uint_t i;
+
+  if(!btree || !consumer)
+    return(FALSE);
+
+  for(n = btree->first; n; n = n->next)
+    for(i = 0; i < n->count; i++)
+      if(!consumer(n->values[i], hook))
+        return(FALSE);
+
+  return(TRUE);
+}
+
+/* values of keys from lo to hi included, in key order */
+
+c_bool_t C_btree_iterate_range(c_btree_t *btree, c_id_t lo, c_id_t hi,
+                               c_bool_t (*consumer)(void *elem, void *hook),
+                               void *hook)
+{
+  c_btree_node_t *n;
+  uint_t i;
+
+  if(!btree || !consumer)
+    return(FALSE);
+
+  for(n = btree->root; !n->leaf;)
+    n = n->children[__C_btree_upper(n->keys, n->count, lo)];
+
+  for(i = __C_btree_lower(n->keys, n->count, lo); n; n = n->next, i = 0)
+  {
+    if(n->next)
+      __builtin_prefetch(n->next);
+    for(; i < n->count; i++)
+    {
+      if(n->keys[i] > hi)
+        return(TRUE);
+      if(!consumer(n->values[i], hook))
+        return(FALSE);
+    }
+  }
+
+  return(TRUE);
+}
+
+/*
+ * build an empty tree bottom up from data sorted by strictly
+ * increasing keys, in O(n). nodes of each level are filled evenly,
+ * thus never below half full.
+ */
+
+c_bool_t C_btree_bulk_load(c_btree_t *tree, const c_datum_t *data, size_t n)
+{
+  c_btree_node_t **nodes, **level, *node;
+  c_id_t *mins;
+  size_t i, j, k, nl, nu, total, cnt;
+
+  if(!tree || tree->nkeys || (n && !data))
+    return(FALSE);
+  for(i = 1; i < n; i++)
+    if(data[i - 1].key >= data[i].key)
+      return(FALSE);
+  if(!n)
+    return(TRUE);
+  if(n > UINT_MAX)
+    return(FALSE);
+
+  // every node of every level, so that nothing is left on failure
+  for(total = nl = (n + tree->order - 1) / tree->order; nl > 1; total += nl)
+    nl = (nl + tree->order) / (tree->order + 1);
+  nodes = C_malloc(total, c_btree_node_t *);
+  mins = C_malloc((n + tree->order - 1) / tree->order, c_id_t);
+  if(!nodes || !mins)
+  {
+    C_free(nodes);
+    C_free(mins);
+    return(FALSE);
+  }
+  nl = (n + tree->order - 1) / tree->order;
+  for(i = 0; i < total; i++)
+  {
+    if(!(nodes[i] = __C_btree_node(tree, i < nl)))
+    {
+      while(i--)
+        C_free(nodes[i]);
+      C_free(nodes);
+      C_free(mins);
+      return(FALSE);
+    }
+  }
+
+  for(i = j = 0; i < nl; i++)
+  {
+    node = nodes[i];
+    node->count = n / nl + (i < n % nl);
+    for(k = 0; k < node->count; k++, j++)
+    {
+      node->keys[k] = data[j].key;
+      node->values[k] = data[j].value;
+    }
+    node->next = i + 1 < nl ? nodes[i + 1] : NULL;
+    mins[i] = node->keys[0];
+  }
+
+  // each upper level over the previous one, mins[] of their subtrees
+  for(level = nodes; nl > 1; level += nl, nl = nu)
+  {
+    nu = (nl + tree->order) / (tree->order + 1);
+    for(i = j = 0; i < nu; i++)
+    {
+      node = level[nl + i];
+      cnt = nl / nu + (i < nl % nu);
+      node->count = cnt - 1;
+      node->children[0] = level[j];
+      mins[i] = mins[j++];
+      for(k = 1; k < cnt; k++, j++)
+      {
+        node->keys[k - 1] = mins[j];
+        node->children[k] = level[j];
+      }
+    }
+  }
+
+  C_free(tree->root);
+  tree->root = level[0];
+  tree->first = nodes[0];
+  tree->nkeys = n;
+  C_free(nodes);
+  C_free(mins);
+
+  return(TRUE);
+}
+
+/* end of btree */
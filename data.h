@@ -21,8 +21,10 @@
 #define _DATA_H_
 
 #include <unistd.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +48,8 @@ extern "C" {
 #undef NUL
 #endif
 
+#define NUL '\0'
+
   typedef char c_bool_t;
 
   typedef unsigned char c_byte_t;
@@ -142,6 +146,16 @@ extern "C" {
 #define C_link_prev(L) ((L)->prev)
 #define C_link_data(L) ((L)->data)
 
+  /*
+   * links come from slabs of C_LINKLIST_SLAB owned by the list, the
+   * first link of each chaining the slabs. unlinked ones go back to
+   * the pool, a chain through next, until the list is destroyed.
+   * p is the cursor of the functions without _r, which modify it:
+   * threads reading the list at once each use a cursor of their own.
+   */
+
+#define C_LINKLIST_SLAB 64
+
   typedef struct c_linklist_t
   {
     c_link_t *head;
@@ -149,6 +163,8 @@ extern "C" {
     c_link_t *p;
     size_t size;
     void (*destructor)(void *);
+    c_link_t *pool;
+    c_link_t *slabs;
   } c_linklist_t;
 
 #define C_linklist_head(L) ((L)->head)
@@ -184,6 +200,10 @@ extern "C" {
   extern c_bool_t C_linklist_delete_r(c_linklist_t *l, c_link_t **p);
   extern c_bool_t C_linklist_move_r(c_linklist_t *l, int where, c_link_t **p);
 
+  extern c_bool_t C_linklist_iterate(c_linklist_t *l,
+                                     c_bool_t (*iter)(void *data, void *hook),
+                                     void *hook);
+
 
 #define C_LINKLIST_HEAD 0
 #define C_LINKLIST_TAIL 1
@@ -221,6 +241,11 @@ extern "C" {
 #define C_linklist_isend_r(L, P)                \
   (*(P) == NULL ? TRUE : FALSE)
 
+#define C_linklist_foreach_r(L, P, D)                           \
+  for(C_linklist_move_head_r((L), (P));                         \
+      ((D) = C_linklist_restore_r((L), (P))) != NULL;           \
+      C_linklist_move_next_r((L), (P)))
+
 /* ----------------------------------------------------------------------------
  * stacks
  * ----------------------------------------------------------------------------
@@ -248,36 +273,73 @@ extern "C" {
  * ----------------------------------------------------------------------------
  */
 
-  typedef c_linklist_t c_queue_t;
+  /*
+   * lock-free and unbounded, for any number of threads at either end:
+   * a list of segments, each a ring chunk of C_QUEUE_SEGMENT slots
+   * claimed by fetch-and-add on its enq and deq indexes. the segments
+   * dequeued through are recycled through the epochs, up to
+   * C_QUEUE_SPARE of them. data may not be NULL.
+   */
 
-#define C_queue_create() C_linklist_create()
-#define C_queue_destroy(Q) C_linklist_destroy(Q)
+#define C_QUEUE_SEGMENT 1024
+#define C_QUEUE_SPARE 16
 
-#define C_queue_set_destructor(Q, D)            \
-  C_linklist_set_destructor((Q), (D))
+  typedef struct c_queueseg_t
+  {
+    uint_t enq;
+    uint_t deq __attribute__((aligned(64)));
+    struct c_queueseg_t *next __attribute__((aligned(64)));
+    struct c_queue_t *queue;
+    void *slots[C_QUEUE_SEGMENT];
+  } c_queueseg_t;
+
+  typedef struct c_queue_t
+  {
+    c_queueseg_t *head;
+    c_queueseg_t *tail __attribute__((aligned(64)));
+    c_queueseg_t *spare __attribute__((aligned(64)));
+    size_t nspare;
+    size_t length;              /* never below the count of data queued */
+    void (*destructor)(void *);
+  } c_queue_t;
 
-#define C_queue_enqueue(Q, D) C_linklist_append((Q), (D))
+  extern c_queue_t *C_queue_create(void);
+  extern void C_queue_destroy(c_queue_t *q);
 
-#define C_queue_dequeue(Q) C_linklist_pop(Q)
+  extern c_bool_t C_queue_set_destructor(c_queue_t *q,
+                                         void (*destructor)(void *));
+
+  extern c_bool_t C_queue_enqueue(c_queue_t *q, const void *data);
+  extern void *C_queue_dequeue(c_queue_t *q);
 
-#define C_queue_length(Q) C_linklist_length(Q)
+#define C_queue_length(Q) __atomic_load_n(&(Q)->length, __ATOMIC_RELAXED)
 
 /* ----------------------------------------------------------------------------
  * dynamic arrays
  * ----------------------------------------------------------------------------
  */
 
+  /*
+   * bit i of free_list is set when element i below bot is deleted, bit
+   * w of free_summary when word w of free_list has any bit set. words
+   * of free_summary before free_hint are all 0.
+   */
+
   typedef struct c_darray_t
   {
     void *mem;
     uint_t resize;
     size_t elemsz;
     uint_t size;
-    uint_t isize;
+    uint_t isize;               /* words of free_list */
     uint_t bot;
     uint_t del_count;
-    char *free_list;
+    uint64_t *free_list;
     uint_t iresize;
+    uint64_t *free_summary;
+    uint_t free_hint;
+    size_t mapped;              /* bytes of mem mapped from a file, or 0 */
+    c_bool_t rdonly;
   } c_darray_t;
 
 #define C_darray_size(A) ((A)->bot - (A)->del_count)
@@ -285,6 +347,22 @@ extern "C" {
 
 #define C_DARRAY_MAX_RESIZE 100
 
+  /*
+   * file format of C_darray_save(): a header of C_DARRAY_FILE_HEADER
+   * bytes, the free list words of the bot elements, then from the
+   * mem_offset of the header, a multiple of C_DARRAY_FILE_ALIGN, the
+   * bot elements. integers are native, the header tells the byte order.
+   * C_darray_map() maps the elements in, read-only or copy-on-write.
+   */
+
+#define C_DARRAY_FILE_MAGIC "CDARRAY"
+#define C_DARRAY_FILE_VERSION 1
+#define C_DARRAY_FILE_HEADER 64
+#define C_DARRAY_FILE_ALIGN 65536
+
+#define C_DARRAY_MAP_RDONLY 0
+#define C_DARRAY_MAP_PRIVATE 1
+
   extern c_darray_t *C_darray_create(uint_t resize, size_t elemsz);
   extern void C_darray_destroy(c_darray_t *a);
 
@@ -293,18 +371,39 @@ extern "C" {
   extern c_bool_t C_darray_delete(c_darray_t *a, uint_t index);
 
   extern c_darray_t *C_darray_load(const char *path);
+  extern c_darray_t *C_darray_map(const char *path, int mode);
   extern c_bool_t C_darray_save(c_darray_t *a, const char *path);
   extern c_darray_t *C_darray_defragment(c_darray_t *a);
+
+#define C_DARRAY_NONE ((uint_t)~0)
+
+  extern c_bool_t C_darray_compact(c_darray_t *a, uint_t *remap);
   extern c_bool_t C_darray_iterate(c_darray_t *a,
                                    c_bool_t (*iter)(void *elem, uint_t index,
                                                     void *hook),
                                    uint_t index, void *hook);
 
+#define C_DARRAY_PARALLEL_MIN 65536
+
+  extern c_bool_t C_darray_iterate_parallel(c_darray_t *a,
+                                            c_bool_t (*iter)(void *elem,
+                                                             uint_t index,
+                                                             void *hook),
+                                            uint_t index, void *hook,
+                                            uint_t nthreads);
+
 /* ----------------------------------------------------------------------------
  * dynamic strings
  * ----------------------------------------------------------------------------
  */
 
+  /*
+   * mem holds the len bytes, NUL-terminated, in blk blocks of blocksz
+   * that double as they fill up, or in the mapped bytes of a file
+   * after C_dstring_load(). a chunked dstring instead keeps the bytes
+   * in blk chunks of blocksz, so it never moves what it holds.
+   */
+
   typedef struct c_dstring_t
   {
     char *mem;
@@ -312,9 +411,13 @@ extern "C" {
     off_t len;
     uint_t blk;
     uint_t blocksz;
+    char **chunks;              /* chunked only, of nchunks slots */
+    uint_t nchunks;
+    size_t mapped;              /* bytes of mem mapped from a file, or 0 */
   } c_dstring_t;
 
 #define C_dstring_length(D) ((D)->len)
+#define C_dstring_ischunked(D) ((D)->chunks != NULL)
 
 #define C_DSTRING_SEEK_ABS 0
 #define C_DSTRING_SEEK_REL 1
@@ -324,6 +427,7 @@ extern "C" {
 #define C_DSTRING_LOAD_BLOCKSZ 4096
 
   extern c_dstring_t *C_dstring_create(uint_t blocksz);
+  extern c_dstring_t *C_dstring_create_chunked(uint_t blocksz);
   extern char *C_dstring_destroy(c_dstring_t *d);
 
   extern c_bool_t C_dstring_putc(c_dstring_t *d, char c);
@@ -337,6 +441,9 @@ extern "C" {
   extern c_dstring_t *C_dstring_load(const char *path, uint_t blocksz);
   extern c_bool_t C_dstring_save(c_dstring_t *d, const char *path);
 
+  extern char *C_dstring_data(c_dstring_t *d);
+  extern char *C_dstring_chunk(c_dstring_t *d, uint_t i, size_t *len);
+
 #define C_dstring_ungetc(D) C_dstring_seek((D), -1L, C_DSTRING_SEEK_REL)
 #define C_dstring_rewind(D) C_dstring_seek((D),  0L, C_DSTRING_SEEK_ABS)
 #define C_dstring_append(D) C_dstring_seek((D),  0L, C_DSTRING_SEEK_END)
@@ -355,15 +462,51 @@ extern "C" {
 #define C_tag_key(T) ((T)->key)
 #define C_tag_data(T) ((T)->data)
 
+  /*
+   * open addressing: buckets are probed by groups of C_HASHTABLE_GROUP,
+   * whose control bytes are matched at once. a control byte holds 7
+   * bits of the hash of a live entry, or C_HASHTABLE_EMPTY, or
+   * C_HASHTABLE_DELETED. entries keep their full hash to skip most key
+   * comparisons.
+   */
+
+#define C_HASHTABLE_GROUP 16
+#define C_HASHTABLE_EMPTY   0x80
+#define C_HASHTABLE_DELETED 0xFE
+
+  typedef struct c_hashentry_t
+  {
+    c_tag_t tag;
+    uint_t hash;
+  } c_hashentry_t;
+
+  typedef struct c_hashslots_t
+  {
+    uint_t buckets;             /* a power of 2, 0 for none */
+    uint_t used;                /* live and deleted entries */
+    c_byte_t *ctrl;
+    c_hashentry_t *entries;
+  } c_hashslots_t;
+
+  /*
+   * a resize moves entries from old to cur a few buckets at a time, on
+   * each store or delete, so that no caller pays for a whole rehash.
+   */
+
   typedef struct c_hashtable_t
   {
-    uint_t buckets;
-    c_linklist_t **table;
+    c_hashslots_t cur;
+    c_hashslots_t old;
+    uint_t migrated;            /* buckets of old already moved */
     size_t size;
     void (*destructor)(void *);
   } c_hashtable_t;
 
 #define C_hashtable_size(H) ((H)->size)
+#define C_hashtable_buckets(H) ((H)->cur.buckets)
+
+#define C_HASHTABLE_MIN_BUCKETS C_HASHTABLE_GROUP
+#define C_HASHTABLE_MIGRATE (2 * C_HASHTABLE_GROUP)
 
   extern c_hashtable_t *C_hashtable_create(uint_t buckets);
   extern void C_hashtable_destroy(c_hashtable_t *h);
@@ -381,6 +524,78 @@ extern "C" {
 
   extern char **C_hashtable_keys(c_hashtable_t *h, size_t *len);
 
+/* ----------------------------------------------------------------------------
+ * epochs
+ * ----------------------------------------------------------------------------
+ */
+
+  /*
+   * what the concurrent containers unlink is freed once every thread
+   * pinned at the time has unpinned. a thread keeping data it got from
+   * one of them across calls pins around the calls and its use of it.
+   * pins nest.
+   */
+
+  extern void C_epoch_pin(void);
+  extern void C_epoch_unpin(void);
+
+/* ----------------------------------------------------------------------------
+ * concurrent hash tables
+ * ----------------------------------------------------------------------------
+ */
+
+  /*
+   * chained buckets read without locks, under an epoch pin. writers
+   * lock the stripe of the bucket, C_CHASHTABLE_STRIPES of them padded
+   * to a cache line each; growing takes all of them and publishes a
+   * copy of the chains, as readers may be walking the old ones. data
+   * replaced or deleted goes to the destructor once no reader can see
+   * it any more.
+   */
+
+#define C_CHASHTABLE_STRIPES 64
+#define C_CHASHTABLE_LOAD 2
+
+  typedef struct c_chashnode_t
+  {
+    struct c_chashnode_t *next;
+    void *data;
+    uint_t hash;
+    char key[];
+  } c_chashnode_t;
+
+  typedef struct c_chashbuckets_t
+  {
+    uint_t buckets;             /* a power of 2, from C_CHASHTABLE_STRIPES */
+    c_chashnode_t **heads;
+  } c_chashbuckets_t;
+
+  typedef struct c_chashstripe_t
+  {
+    pthread_mutex_t mutex;
+  } __attribute__((aligned(64))) c_chashstripe_t;
+
+  typedef struct c_chashtable_t
+  {
+    c_chashbuckets_t *table;
+    c_chashstripe_t stripes[C_CHASHTABLE_STRIPES];
+    size_t size;
+    void (*destructor)(void *);
+  } c_chashtable_t;
+
+#define C_chashtable_size(H) __atomic_load_n(&(H)->size, __ATOMIC_RELAXED)
+
+  extern c_chashtable_t *C_chashtable_create(uint_t buckets);
+  extern void C_chashtable_destroy(c_chashtable_t *h);
+
+  extern c_bool_t C_chashtable_set_destructor(c_chashtable_t *h,
+                                              void (*destructor)(void *));
+
+  extern c_bool_t C_chashtable_store(c_chashtable_t *h, const char *key,
+                                     const void *data);
+  extern void *C_chashtable_restore(c_chashtable_t *h, const char *key);
+  extern c_bool_t C_chashtable_delete(c_chashtable_t *h, const char *key);
+
 /* ----------------------------------------------------------------------------
  * b-trees
  * ----------------------------------------------------------------------------
@@ -400,21 +615,42 @@ extern "C" {
 #define C_datum_value(D)                        \
   (D)->value
 
+  /*
+   * a B+tree: values are in leaves only, linked in key order, inner
+   * nodes hold count keys separating count + 1 children. a node is a
+   * 64 bytes header followed by its keys, whose array fills whole cache
+   * lines, then its values or children. order is the most keys of a
+   * node, one less than a multiple of C_BTREE_LINE_KEYS; nodes have
+   * room for one more while being split.
+   */
+
+#define C_BTREE_LINE 64
+#define C_BTREE_LINE_KEYS (C_BTREE_LINE / sizeof(c_id_t))
+#define C_BTREE_DEFAULT_ORDER 31
+#define C_BTREE_MAX_ORDER 1023
+#define C_BTREE_MAX_DEPTH 32
+
   typedef struct c_btree_node_t
   {
     uint_t count;
-    c_datum_t *keys;
+    c_bool_t leaf;
+    c_id_t *keys;
     struct c_btree_node_t **children;
+    void **values;
+    struct c_btree_node_t *next;
   } c_btree_node_t;
 
   typedef struct c_btree_t
   {
     c_btree_node_t *root;
+    c_btree_node_t *first;
     uint_t order;
     uint_t nkeys;
     void (*destructor)(void *);
   } c_btree_t;
 
+#define C_btree_size(T) ((T)->nkeys)
+
   extern c_btree_t *C_btree_create(uint_t order);
   extern void C_btree_destroy(c_btree_t *tree);
 
@@ -429,6 +665,13 @@ extern "C" {
   extern c_bool_t C_btree_iterate(c_btree_t *btree,
                                   c_bool_t (*consumer)(void *elem, void *hook),
                                   void *hook);
+  extern c_bool_t C_btree_iterate_range(c_btree_t *btree, c_id_t lo, c_id_t hi,
+                                        c_bool_t (*consumer)(void *elem,
+                                                             void *hook),
+                                        void *hook);
+
+  extern c_bool_t C_btree_bulk_load(c_btree_t *tree, const c_datum_t *data,
+                                    size_t n);
   
 #define C_btree_order(T)                        \
   ((T)->order)
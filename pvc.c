@@ -19,22 +19,354 @@
  *
  * =====================================================================================
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #include "data.h"
 #include "pvc.h"
 
+/*
+ * Static tracepoints (USDT), visible to perf/bpftrace/systemtap as
+ * provider "pvc" when <sys/sdt.h> is available at build time. Each
+ * probe is a single nop while no tracer is attached. Define PVC_NO_SDT
+ * to compile them out entirely.
+ */
+#if !defined(PVC_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PVC_HAVE_SDT 1
+#endif
+#endif
+
+#if PVC_HAVE_SDT
+#define PVC_PROBE(name,args...) STAP_PROBEV( pvc, name, ##args )
+#else
+#define PVC_PROBE(name,args...) ((void)0)
+#endif
+
+/*
+ * mutex with optional contention accounting, see
+ * pvc_set_lock_profiling(). counters are only updated by the owner
+ * of the mutex, so they need no further locking.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    const char *name;
+    int profiling;
+    unsigned long long n_acquire, n_contended;
+    unsigned long long wait_ns, max_wait_ns, hold_ns;
+    struct timespec acquired;
+} profiled_mutex_t;
+
+static inline unsigned long long _pvc_elapsed_ns( const struct timespec *from, const struct timespec *to )
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+static void profiled_mutex_init( profiled_mutex_t *m, const char *name )
+{
+    memset( m, 0, sizeof(*m) );
+    pthread_mutex_init( &m->mutex, NULL );
+    m->name = name;
+}
+static void profiled_mutex_reset( profiled_mutex_t *m )
+{
+    m->n_acquire = m->n_contended = 0;
+    m->wait_ns = m->max_wait_ns = m->hold_ns = 0;
+}
+static inline void profiled_mutex_lock( profiled_mutex_t *m )
+{
+    struct timespec t0;
+    unsigned long long wait;
+
+    if ( !m->profiling ) {
+        pthread_mutex_lock( &m->mutex );
+        return;
+    }
+
+    if ( pthread_mutex_trylock( &m->mutex ) != 0 ) {
+        clock_gettime( CLOCK_MONOTONIC, &t0 );
+        pthread_mutex_lock( &m->mutex );
+        clock_gettime( CLOCK_MONOTONIC, &m->acquired );
+        wait = _pvc_elapsed_ns( &t0, &m->acquired );
+        m->n_contended++;
+        m->wait_ns += wait;
+        if ( wait > m->max_wait_ns )
+            m->max_wait_ns = wait;
+    } else {
+        clock_gettime( CLOCK_MONOTONIC, &m->acquired );
+    }
+    m->n_acquire++;
+}
+static inline void profiled_mutex_unlock( profiled_mutex_t *m )
+{
+    struct timespec now;
+
+    if ( m->profiling ) {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        m->hold_ns += _pvc_elapsed_ns( &m->acquired, &now );
+    }
+    pthread_mutex_unlock( &m->mutex );
+}
+/* time spent blocked on the condition is not hold time */
+static inline void profiled_cond_wait( pthread_cond_t *cond, profiled_mutex_t *m )
+{
+    struct timespec now;
+
+    if ( m->profiling ) {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        m->hold_ns += _pvc_elapsed_ns( &m->acquired, &now );
+    }
+    pthread_cond_wait( cond, &m->mutex );
+    if ( m->profiling )
+        clock_gettime( CLOCK_MONOTONIC, &m->acquired );
+}
+
+/* what travels along with an element besides its data */
+typedef struct {
+    size_t bytes;                   // see pvc_declare_size()
+    unsigned long long deadline;    // CLOCK_MONOTONIC ns, 0 for none
+    unsigned long long key;         // see pvc_set_conflation()
+} rb_meta_t;
+
+#define RB_EXPIRE_BATCH 32
+
+/* expired elements retired by a pop, for the caller to discard */
+typedef struct {
+    unsigned int n;
+    void *elems[ RB_EXPIRE_BATCH ];
+} rb_expired_t;
+
+/*
+ * in pointer mode (slot_size 0) the ring holds data pointers in
+ * elems[], or in handle mode indexes into the slab of the element
+ * pool in handles[]. in value mode it holds copies of slot_size bytes
+ * each stride bytes apart in slots[].
+ *
+ * value mode slots may also be used in place, see pvc_reserve() and
+ * pvc_peek(): [head,peek) is handed to consumers, [peek,tail) is
+ * ready for them, [tail,reserve) is being written by producers.
+ * state[] tracks slots committed or released out of order, in
+ * pointer mode peek is always head and reserve always tail.
+ */
 typedef struct {
     void **elems;
+    uint32_t *handles;
+    const char *slab;
+    size_t slab_stride, slab_n;
+    size_t *elem_bytes;
+    size_t bytes, byte_budget, max_bytes;
+    int shed;
+    unsigned long long n_shed;
+    pvc_overflow_t overflow;
+    unsigned int sample_n, n_overflow;
+    unsigned long long n_dropped, n_evicted;
+    unsigned long long *deadlines, default_ttl;
+    int expiring;
+    unsigned long long n_expired;
+    uint32_t *key_map;
+    size_t key_mask;
+    unsigned long long *keys;
+    int conflating;
+    unsigned long long n_conflated;
+    char *slots;
+    unsigned char *state;
+    size_t slot_size, stride;
     size_t size, len;
     size_t head, tail;
-    pthread_mutex_t mutex;
+    size_t peek, reserve;
+    profiled_mutex_t mutex;
     pthread_cond_t not_empty, not_full;
     int user_count;
+    unsigned int id;
+    int sampling;
+    unsigned long long occ_sum, occ_samples;
+    size_t occ_max;
+    c_queue_t *queue;               // see PVC_UNBOUNDED, instead of all above
 } ring_buffer_t;
 
+#define RB_SLOT(rb,i) ((rb)->slots + (i) * (rb)->stride)
+#define RB_BYTES(rb) ((rb)->size * (rb)->stride + ((rb)->state ? (rb)->size : 0))
+#define RB_INDEX(rb,slot) ((size_t)((char*)(slot) - (rb)->slots) / (rb)->stride)
+#define RB_NEXT(rb,i) (((i) + 1) % (rb)->size)
+#define RB_FULL(rb) (RB_NEXT( rb, (rb)->reserve ) == (rb)->head)
+
+/* no room for n more bytes, though one element always fits an empty ring */
+#define RB_OVER_BUDGET(rb,n) ((rb)->byte_budget && (rb)->bytes > 0 && \
+                              (rb)->bytes + (n) > (rb)->byte_budget)
+
+static inline unsigned long long _pvc_now_ns( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* meta data of element i, in any mode */
+static inline void _rb_put_meta( ring_buffer_t *rb, size_t i, const rb_meta_t *meta )
+{
+    if ( rb->elem_bytes ) {
+        rb->elem_bytes[i] = meta->bytes;
+        rb->bytes += meta->bytes;
+        if ( rb->bytes > rb->max_bytes )
+            rb->max_bytes = rb->bytes;
+    }
+    if ( rb->deadlines )
+        rb->deadlines[i] = meta->deadline ? meta->deadline :
+                           rb->default_ttl ? _pvc_now_ns() + rb->default_ttl : 0;
+}
+static inline void _rb_get_meta( ring_buffer_t *rb, size_t i, rb_meta_t *meta )
+{
+    if ( rb->elem_bytes )
+        rb->bytes -= rb->elem_bytes[i];
+    if ( meta ) {
+        meta->bytes = rb->elem_bytes ? rb->elem_bytes[i] : 0;
+        meta->deadline = rb->deadlines ? rb->deadlines[i] : 0;
+    }
+}
+
+/* pointer or handle mode element */
+static inline void _rb_put( ring_buffer_t *rb, size_t i, void *data, const rb_meta_t *meta )
+{
+    _rb_put_meta( rb, i, meta );
+    if ( rb->handles ) {
+        const size_t h = (size_t)( (char*)data - rb->slab ) / rb->slab_stride;
+
+        assert( (char*)data >= rb->slab && h < rb->slab_n );
+        rb->handles[i] = (uint32_t)h;
+    } else {
+        rb->elems[i] = data;
+    }
+}
+static inline void * _rb_get( ring_buffer_t *rb, size_t i, rb_meta_t *meta )
+{
+    _rb_get_meta( rb, i, meta );
+    if ( rb->handles )
+        return (void*)( rb->slab + rb->handles[i] * rb->slab_stride );
+    return rb->elems[i];
+}
+
+/* slot states, 0 for slots whose state follows from the indices */
+enum {
+    RB_RESERVED_FIRST = 1,  // first slot of a reservation
+    RB_RESERVED,
+    RB_COMMITTED,
+    RB_VOID,                // reserved but not committed, skipped
+    RB_RELEASED,
+};
+
+/*
+ * conflation: key_map is a linear probing table of slot + 1, 0 for
+ * none, keyed by keys[slot]. it holds at most one entry per slot and
+ * per key, entries of slots no longer queued are left until the slot
+ * is reused.
+ */
+#define RB_KEY_HASH(rb,key) ((size_t)( (key) * 0x9E3779B97F4A7C15ULL >> 32 ) & (rb)->key_mask)
+
+static uint32_t * _rb_key_find( ring_buffer_t *rb, unsigned long long key )
+{
+    size_t i;
+
+    for ( i = RB_KEY_HASH( rb, key ); rb->key_map[i]; i = (i + 1) & rb->key_mask )
+        if ( rb->keys[ rb->key_map[i] - 1 ] == key )
+            return &rb->key_map[i];
+    return NULL;
+}
+static void _rb_key_unmap( ring_buffer_t *rb, size_t s )
+{
+    uint32_t * const e = _rb_key_find( rb, rb->keys[s] );
+    size_t i, j, h;
+
+    if ( !e || *e != s + 1 )
+        return;
+
+    // shift back the entries probed past this one
+    i = e - rb->key_map;
+    for ( j = (i + 1) & rb->key_mask; rb->key_map[j]; j = (j + 1) & rb->key_mask ) {
+        h = RB_KEY_HASH( rb, rb->keys[ rb->key_map[j] - 1 ] );
+        if ( ( (j - h) & rb->key_mask ) >= ( (j - i) & rb->key_mask ) ) {
+            rb->key_map[i] = rb->key_map[j];
+            i = j;
+        }
+    }
+    rb->key_map[i] = 0;
+}
+static void _rb_key_map( ring_buffer_t *rb, size_t s, unsigned long long key )
+{
+    uint32_t * e;
+    size_t i;
+
+    _rb_key_unmap( rb, s );
+    rb->keys[s] = key;
+    if ( !( e = _rb_key_find( rb, key ) ) ) {
+        for ( i = RB_KEY_HASH( rb, key ); rb->key_map[i]; i = (i + 1) & rb->key_mask )
+            ;
+        e = &rb->key_map[i];
+    }
+    *e = s + 1;
+}
+/* slot s is ready for consumers, not handed to them yet */
+static inline int _rb_queued( ring_buffer_t *rb, size_t s )
+{
+    // void slots were reserved, thus never mapped
+    return ( s + rb->size - rb->peek ) % rb->size < ( rb->tail + rb->size - rb->peek ) % rb->size;
+}
+
+/* elements currently held, callers should own rb->mutex for exact value */
+#define RB_OCCUPANCY(rb) ((rb)->queue ? C_queue_length( (rb)->queue ) : \
+                          ((rb)->tail + (rb)->size - (rb)->head) % (rb)->size)
+
+/* occupancy seen by a ring operation, under rb->mutex */
+#define RB_SAMPLE(rb) do {                              \
+    if ( (rb)->sampling ) {                             \
+        const size_t _occ = RB_OCCUPANCY( rb );         \
+        (rb)->occ_sum += _occ;                          \
+        (rb)->occ_samples++;                            \
+        if ( _occ > (rb)->occ_max )                     \
+            (rb)->occ_max = _occ;                       \
+    }                                                   \
+} while (0)
+
+/*
+ * fixed-size element pool, see pvc_set_pool(). free elements are kept
+ * in a global stack, and PVC threads keep a cache of their own which
+ * is refilled from and spilled to the stack by batches.
+ */
+typedef struct {
+    char *mem;
+    size_t mem_len;
+    size_t elem_size, n_elems;
+    profiled_mutex_t mutex;
+    void **free_elems;
+    size_t n_free;
+} elem_pool_t;
+
+typedef struct {
+    elem_pool_t *pool;
+    unsigned int n;
+    void *elems[ PVC_POOL_CACHE ];
+} pool_cache_t;
+
+#define POOL_BATCH (PVC_POOL_CACHE / 2)
+
 typedef struct {
     pthread_t tid;
     void *ret;
@@ -42,9 +374,20 @@ typedef struct {
     pvc_info_t info;
     ring_buffer_t *ring_buffer;
     void *callback;
-    pthread_mutex_t *callback_mutex;
+    profiled_mutex_t *callback_mutex;
     pthread_mutex_t *inited_mutex;
     void *arg;
+    pvc_t pvc;
+    int perf_fd[ PVC_PERF_NR ];
+    unsigned int perf_open, perf_valid;
+    unsigned long long perf[ PVC_PERF_NR ];
+    long perf_nvcsw;        // rusage baseline, taken when perf_rusage
+    int perf_rusage;
+    unsigned long long service_ns, service_cpu_ns;
+    pool_cache_t pool_cache;
+    void *slot_buf, *evict_buf;
+    rb_meta_t meta;
+    rb_expired_t expired;
 } thread_context_t;
 
 #define PVC_STATUS_CONSUMER_RUNNING 0x01
@@ -53,119 +396,1008 @@ typedef struct {
 #define PVC_STATUS_CLEANNING 0x8000
 
 struct pvc_s {
+    unsigned int id;
     int status;
     c_linklist_t * thread_contexts;
     ring_buffer_t ring_buffer;
     pthread_mutex_t mutex_inited;
-    pthread_mutex_t mutex_producer;
-    pthread_mutex_t mutex_consumer;
+    pthread_mutex_t mutex_perf;     // perf state of the thread contexts
+    profiled_mutex_t mutex_producer;
+    profiled_mutex_t mutex_consumer;
     unsigned int n_producer, n_consumer;
+    int perf_enabled;
+    int stage_profiling;
+    c_linklist_t * stopped_stats;
+    struct timespec started, stopped;
+    elem_pool_t * pool;
+    pvc_cb_consume_func_t discard;
+    pvc_cb_key_func_t key;
+    int shed;
+    pvc_overflow_t overflow;
+    struct {
+        size_t stack_size, guard_size;
+    } thread_attr[3];       // see _pvc_thread_role()
+    char thread_name[32];
+    int mem_flags;
+    void * rb_mem;
+    size_t rb_mem_len;
 };
 
 static pthread_once_t _pvc_once = PTHREAD_ONCE_INIT;
 static pthread_key_t _pvc_info_key;
+static unsigned int _pvc_last_id = 0;
+
+#if PVC_HAVE_SDT
+/* thread index for probes fired outside the thread loops */
+static inline unsigned int _pvc_probe_index( void )
+{
+    const pvc_info_t * const info = pthread_getspecific( _pvc_info_key );
+    return info ? info->index : 0;
+}
+#endif
+
+/* move tail over committed slots, return the number of slots passed */
+static size_t _rb_advance_tail( ring_buffer_t *rb )
+{
+    size_t n = 0;
+
+    while ( rb->tail != rb->reserve &&
+            ( rb->state[ rb->tail ] == RB_COMMITTED || rb->state[ rb->tail ] == RB_VOID ) ) {
+        // void slots stay marked for consumers to skip
+        if ( rb->state[ rb->tail ] == RB_COMMITTED )
+            rb->state[ rb->tail ] = 0;
+        rb->tail = RB_NEXT( rb, rb->tail );
+        n++;
+    }
+
+    return n;
+}
+/* move head over released slots, return the number of slots freed */
+static size_t _rb_advance_head( ring_buffer_t *rb )
+{
+    size_t n = 0;
+
+    while ( rb->head != rb->peek && rb->state[ rb->head ] == RB_RELEASED ) {
+        rb->state[ rb->head ] = 0;
+        rb->head = RB_NEXT( rb, rb->head );
+        n++;
+    }
+
+    return n;
+}
+/* release void slots ready for consumers, return the number of slots freed */
+static size_t _rb_skip_void( ring_buffer_t *rb )
+{
+    if ( !rb->state )
+        return 0;
+
+    while ( rb->peek != rb->tail && rb->state[ rb->peek ] == RB_VOID ) {
+        rb->state[ rb->peek ] = RB_RELEASED;
+        rb->peek = RB_NEXT( rb, rb->peek );
+    }
+
+    return _rb_advance_head( rb );
+}
+/*
+ * retire expired elements ready for consumers, see pvc_set_expiry():
+ * values are released, pointers go to expired, up to RB_EXPIRE_BATCH.
+ * return the number of slots freed.
+ */
+static size_t _rb_expire( ring_buffer_t *rb, rb_expired_t *expired )
+{
+    unsigned long long now;
+    size_t n = 0;
+
+    if ( !rb->expiring || rb->peek == rb->tail )
+        return 0;
+
+    now = _pvc_now_ns();
+    if ( rb->slot_size ) {
+        while ( rb->peek != rb->tail &&
+                ( rb->state[ rb->peek ] == RB_VOID ||
+                  ( rb->deadlines[ rb->peek ] && rb->deadlines[ rb->peek ] <= now ) ) ) {
+            if ( rb->state[ rb->peek ] != RB_VOID )
+                rb->n_expired++;
+            rb->state[ rb->peek ] = RB_RELEASED;
+            rb->peek = RB_NEXT( rb, rb->peek );
+        }
+        return _rb_advance_head( rb );
+    }
+
+    while ( expired && expired->n < RB_EXPIRE_BATCH && rb->head != rb->tail &&
+            rb->deadlines[ rb->head ] && rb->deadlines[ rb->head ] <= now ) {
+        expired->elems[ expired->n++ ] = _rb_get( rb, rb->head, NULL );
+        rb->peek = rb->head = RB_NEXT( rb, rb->head );
+        rb->n_expired++;
+        n++;
+    }
+    return n;
+}
+static inline void _rb_wakeup( pthread_cond_t *cond, size_t n )
+{
+    if ( n > 1 )
+        pthread_cond_broadcast( cond );
+    else if ( n == 1 )
+        pthread_cond_signal( cond );
+}
 
 int ring_buffer_empty( ring_buffer_t *rb )
 {
-    pthread_mutex_t * const mutex = &rb->mutex;
+    profiled_mutex_t * const mutex = &rb->mutex;
     int result;
 
-    pthread_mutex_lock( mutex );
+    if ( rb->queue )
+        return C_queue_length( rb->queue ) == 0;
+
+    profiled_mutex_lock( mutex );
     result = (rb->head == rb->tail) ? 1 : 0;
-    pthread_mutex_unlock( mutex );
+    profiled_mutex_unlock( mutex );
+
+    return result;
+}
+int ring_buffer_full( ring_buffer_t *rb )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    size_t tmp;
+    int result;
+
+    if ( rb->queue )
+        return 0;
+
+    profiled_mutex_lock( mutex );
+    tmp = rb->reserve + 1 + rb->size - rb->head;
+    result = (tmp == 0 || tmp == rb->size) ? 1 : 0;
+    profiled_mutex_unlock( mutex );
 
     return result;
 }
-int ring_buffer_full( ring_buffer_t *rb )
+/*
+ * an unbounded ring never blocks producers, which only take the mutex
+ * to wake a consumer waiting for data.
+ */
+static int _rb_queue_append( ring_buffer_t *rb, void *data )
+{
+    if ( !C_queue_enqueue( rb->queue, data ) )
+        return -1;
+    PVC_PROBE( rb_append, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+
+    // pairs with the one of a consumer counting itself in before waiting
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &rb->user_count, __ATOMIC_RELAXED ) > 0 ) {
+        profiled_mutex_lock( &rb->mutex );
+        pthread_cond_signal( &rb->not_empty );
+        profiled_mutex_unlock( &rb->mutex );
+    }
+
+    return 0;
+}
+static void * _rb_queue_pop( ring_buffer_t *rb, rb_meta_t *meta )
+{
+    void * data;
+
+    if ( meta )
+        memset( meta, 0, sizeof(*meta) );
+
+    data = C_queue_dequeue( rb->queue );
+    if ( !data ) {
+        profiled_mutex_lock( &rb->mutex );
+        __atomic_add_fetch( &rb->user_count, 1, __ATOMIC_SEQ_CST );
+        data = C_queue_dequeue( rb->queue );
+        if ( !data ) {
+            PVC_PROBE( rb_wait_empty, rb->id, _pvc_probe_index(), 0 );
+            profiled_cond_wait( &rb->not_empty, &rb->mutex );
+            PVC_PROBE( rb_wake_empty, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        }
+        __atomic_sub_fetch( &rb->user_count, 1, __ATOMIC_RELAXED );
+        profiled_mutex_unlock( &rb->mutex );
+        if ( !data )
+            data = C_queue_dequeue( rb->queue );
+    }
+    if ( data )
+        PVC_PROBE( rb_pop, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+
+    return data;
+}
+/*
+ * returns 0 when data is queued, -1 when there is still no room for it
+ * after one wait, 1 when it is to be shed over the byte budget.
+ */
+int ring_buffer_prepend( ring_buffer_t *rb, void *data, const rb_meta_t *meta )
+{
+    const size_t bytes = meta->bytes;
+    profiled_mutex_t * const mutex = &rb->mutex;
+    int to_signal = 0;
+
+    assert( !rb->queue );
+
+    // there is no room in front of slots handed to consumers
+    profiled_mutex_lock( mutex );
+    if ( RB_OVER_BUDGET( rb, bytes ) && rb->shed ) {
+        rb->n_shed++;
+        profiled_mutex_unlock( mutex );
+        return 1;
+    }
+    if ( RB_FULL( rb ) || RB_OVER_BUDGET( rb, bytes ) || rb->peek != rb->head ) {
+        rb->user_count++;
+        PVC_PROBE( rb_wait_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        profiled_cond_wait( &rb->not_full, mutex );
+        PVC_PROBE( rb_wake_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        rb->user_count--;
+    }
+    if ( !RB_FULL( rb ) && !RB_OVER_BUDGET( rb, bytes ) && rb->peek == rb->head ) {
+        rb->head = (rb->head + rb->size - 1) % rb->size;
+        rb->peek = rb->head;
+        if ( rb->slot_size ) {
+            memcpy( RB_SLOT( rb, rb->head ), data, rb->slot_size );
+            _rb_put_meta( rb, rb->head, meta );
+        } else {
+            _rb_put( rb, rb->head, data, meta );
+        }
+        if ( rb->conflating )
+            _rb_key_map( rb, rb->head, meta->key );
+        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->head, data );
+        to_signal = 1;
+        PVC_PROBE( rb_prepend, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        RB_SAMPLE( rb );
+    }
+    profiled_mutex_unlock( mutex );
+
+    if ( to_signal )
+        pthread_cond_signal( &rb->not_empty );
+
+    return to_signal ? 0 : -1;
+}
+/*
+ * take the oldest element out of a full ring, see pvc_set_overflow().
+ * in value mode it is copied to buf. fails while consumers hold slots
+ * at the head.
+ */
+static void * _rb_evict( ring_buffer_t *rb, void *buf )
+{
+    void * data;
+
+    _rb_skip_void( rb );
+    if ( rb->peek != rb->head || rb->head == rb->tail )
+        return NULL;
+
+    if ( rb->slot_size )
+        data = memcpy( buf, RB_SLOT( rb, rb->head ), rb->slot_size );
+    else
+        data = _rb_get( rb, rb->head, NULL );
+    rb->peek = rb->head = RB_NEXT( rb, rb->head );
+    rb->n_evicted++;
+
+    return data;
+}
+/*
+ * same as ring_buffer_prepend(), and applies the overflow policy when
+ * there is no room: 1 when data is dropped, and any element evicted
+ * goes to *evicted, which points to a buffer for it in value mode.
+ * both are for the caller to discard. an element queued under the
+ * same key is replaced in place, and goes to *evicted as well.
+ */
+int ring_buffer_append( ring_buffer_t *rb, void *data, const rb_meta_t *meta, void **evicted )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    const size_t bytes = meta->bytes;
+    void * const evict_buf = *evicted;
+    int to_signal = 0, ret = -1;
+
+    *evicted = NULL;
+
+    if ( rb->queue )
+        return _rb_queue_append( rb, data );
+
+    profiled_mutex_lock( mutex );
+    if ( rb->conflating ) {
+        const uint32_t * const e = _rb_key_find( rb, meta->key );
+
+        if ( e && _rb_queued( rb, *e - 1 ) ) {
+            const size_t s = *e - 1;
+
+            if ( rb->slot_size ) {
+                *evicted = memcpy( evict_buf, RB_SLOT( rb, s ), rb->slot_size );
+                memcpy( RB_SLOT( rb, s ), data, rb->slot_size );
+                _rb_put_meta( rb, s, meta );
+            } else {
+                *evicted = _rb_get( rb, s, NULL );
+                _rb_put( rb, s, data, meta );
+            }
+            rb->n_conflated++;
+            PVC_PROBE( rb_append, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+            profiled_mutex_unlock( mutex );
+            return 0;
+        }
+    }
+    if ( RB_OVER_BUDGET( rb, bytes ) && rb->shed ) {
+        rb->n_shed++;
+        profiled_mutex_unlock( mutex );
+        return 1;
+    }
+    if ( ( RB_FULL( rb ) || RB_OVER_BUDGET( rb, bytes ) ) && rb->overflow ) {
+        // keep 1 in sample_n of the elements finding no room
+        if ( rb->overflow == PVC_OVERFLOW_DROP_NEWEST ||
+             ( rb->overflow == PVC_OVERFLOW_SAMPLE && ++rb->n_overflow % rb->sample_n ) ) {
+            rb->n_dropped++;
+            profiled_mutex_unlock( mutex );
+            return 1;
+        }
+        *evicted = _rb_evict( rb, evict_buf );
+    }
+    if ( RB_FULL( rb ) || RB_OVER_BUDGET( rb, bytes ) ) {
+        rb->user_count++;
+        PVC_PROBE( rb_wait_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        profiled_cond_wait( &rb->not_full, mutex );
+        PVC_PROBE( rb_wake_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        rb->user_count--;
+    }
+    if ( !RB_FULL( rb ) && !RB_OVER_BUDGET( rb, bytes ) ) {
+        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->reserve, data );
+        if ( rb->slot_size ) {
+            // behind reservations not yet committed, if any
+            memcpy( RB_SLOT( rb, rb->reserve ), data, rb->slot_size );
+            _rb_put_meta( rb, rb->reserve, meta );
+            if ( rb->conflating )
+                _rb_key_map( rb, rb->reserve, meta->key );
+            rb->state[ rb->reserve ] = RB_COMMITTED;
+            rb->reserve = RB_NEXT( rb, rb->reserve );
+            to_signal = _rb_advance_tail( rb ) > 0;
+        } else {
+            _rb_put( rb, rb->tail, data, meta );
+            if ( rb->conflating )
+                _rb_key_map( rb, rb->tail, meta->key );
+            rb->reserve = rb->tail = RB_NEXT( rb, rb->tail );
+            to_signal = 1;
+        }
+        ret = 0;
+        PVC_PROBE( rb_append, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        RB_SAMPLE( rb );
+    }
+    profiled_mutex_unlock( mutex );
+
+    if ( to_signal )
+        pthread_cond_signal( &rb->not_empty );
+
+    return ret;
+}
+/*
+ * in value mode, the element is copied to buf which is returned. its
+ * meta data go to *meta, if not NULL. expired elements in pointer mode
+ * go to *expired, the element is NULL when it is full.
+ */
+void * ring_buffer_pop( ring_buffer_t *rb, void *buf, rb_meta_t *meta, rb_expired_t *expired )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    const unsigned int n_expired = expired->n;
+    size_t to_signal = 0;
+    void * data = NULL;
+
+    if ( rb->queue )
+        return _rb_queue_pop( rb, meta );
+
+    profiled_mutex_lock( mutex );
+    to_signal += _rb_skip_void( rb ) + _rb_expire( rb, expired );
+    if ( rb->peek == rb->tail && expired->n == n_expired ) {
+        // producers waiting for the slots just freed would never be woken
+        _rb_wakeup( &rb->not_full, to_signal );
+        to_signal = 0;
+        rb->user_count++;
+        PVC_PROBE( rb_wait_empty, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        profiled_cond_wait( &rb->not_empty, mutex );
+        PVC_PROBE( rb_wake_empty, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        rb->user_count--;
+        to_signal += _rb_skip_void( rb ) + _rb_expire( rb, expired );
+    }
+    if ( rb->peek != rb->tail && expired->n < RB_EXPIRE_BATCH ) {
+        if ( rb->slot_size ) {
+            // after slots still handed to other consumers, if any
+            data = memcpy( buf, RB_SLOT( rb, rb->peek ), rb->slot_size );
+            _rb_get_meta( rb, rb->peek, meta );
+            rb->state[ rb->peek ] = RB_RELEASED;
+            rb->peek = RB_NEXT( rb, rb->peek );
+            to_signal += _rb_advance_head( rb );
+        } else {
+            data = _rb_get( rb, rb->head, meta );
+            rb->peek = rb->head = RB_NEXT( rb, rb->head );
+            to_signal++;
+        }
+        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->head, data );
+        PVC_PROBE( rb_pop, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        RB_SAMPLE( rb );
+    }
+    profiled_mutex_unlock( mutex );
+
+    _rb_wakeup( &rb->not_full, to_signal );
+
+    return data;
+}
+/*
+ * reserve up to n free slots following each other in memory, the
+ * first of which goes to *slots. returns the number of slots reserved,
+ * 0 if still full after one wait.
+ */
+size_t ring_buffer_reserve( ring_buffer_t *rb, void **slots, size_t n )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    size_t i, end;
+
+    assert( rb->slot_size );
+
+    profiled_mutex_lock( mutex );
+    if ( RB_FULL( rb ) ) {
+        rb->user_count++;
+        PVC_PROBE( rb_wait_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        profiled_cond_wait( &rb->not_full, mutex );
+        PVC_PROBE( rb_wake_full, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        rb->user_count--;
+    }
+    if ( n > 0 && !RB_FULL( rb ) ) {
+        // up to the slot before head, or the end of ring
+        end = rb->head > rb->reserve ? rb->head - 1 :
+              rb->head > 0 ? rb->size : rb->size - 1;
+        if ( n > end - rb->reserve )
+            n = end - rb->reserve;
+        *slots = RB_SLOT( rb, rb->reserve );
+        rb->state[ rb->reserve ] = RB_RESERVED_FIRST;
+        for ( i = 1; i < n; i++ )
+            rb->state[ rb->reserve + i ] = RB_RESERVED;
+        // written in place, never conflated
+        for ( i = 0; rb->conflating && i < n; i++ )
+            _rb_key_unmap( rb, rb->reserve + i );
+        rb->reserve = (rb->reserve + n) % rb->size;
+        PVC_PROBE( rb_reserve, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+    } else {
+        *slots = NULL;
+        n = 0;
+    }
+    profiled_mutex_unlock( mutex );
+
+    return n;
+}
+/*
+ * publish the first n slots of the reservation starting at slots,
+ * with the same meta data, and give up the rest of it.
+ */
+void ring_buffer_commit( ring_buffer_t *rb, void *slots, size_t n, const rb_meta_t *meta )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    const size_t first = RB_INDEX( rb, slots );
+    size_t i, m, to_signal, n_freed = 0;
+
+    profiled_mutex_lock( mutex );
+    assert( rb->state[ first ] == RB_RESERVED_FIRST );
+    for ( m = 1; first + m < rb->size && first + m != rb->reserve &&
+                 rb->state[ first + m ] == RB_RESERVED; m++ )
+        ;
+    assert( n <= m );
+    for ( i = 0; i < n; i++ ) {
+        rb->state[ first + i ] = RB_COMMITTED;
+        _rb_put_meta( rb, first + i, meta );
+    }
+    if ( n < m && (first + m) % rb->size == rb->reserve ) {
+        // the last reservation, simply take it back
+        memset( &rb->state[ first + n ], 0, m - n );
+        rb->reserve = first + n;
+        n_freed = m - n;
+    } else if ( n < m ) {
+        memset( &rb->state[ first + n ], RB_VOID, m - n );
+    }
+    to_signal = _rb_advance_tail( rb );
+    PVC_PROBE( rb_commit, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+    RB_SAMPLE( rb );
+    profiled_mutex_unlock( mutex );
+
+    _rb_wakeup( &rb->not_empty, to_signal );
+    _rb_wakeup( &rb->not_full, n_freed );
+}
+/*
+ * hand up to n committed slots following each other in memory to the
+ * caller, the first of which goes to *slots. returns the number of
+ * slots, 0 if still empty after one wait.
+ */
+size_t ring_buffer_peek( ring_buffer_t *rb, void **slots, size_t n )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    size_t i, end, to_signal = 0;
+
+    assert( rb->slot_size );
+
+    profiled_mutex_lock( mutex );
+    to_signal += _rb_skip_void( rb ) + _rb_expire( rb, NULL );
+    if ( rb->peek == rb->tail ) {
+        _rb_wakeup( &rb->not_full, to_signal );
+        to_signal = 0;
+        rb->user_count++;
+        PVC_PROBE( rb_wait_empty, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        profiled_cond_wait( &rb->not_empty, mutex );
+        PVC_PROBE( rb_wake_empty, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+        rb->user_count--;
+        to_signal += _rb_skip_void( rb ) + _rb_expire( rb, NULL );
+    }
+    if ( n > 0 && rb->peek != rb->tail ) {
+        // up to tail, the end of ring, or the next void slot
+        end = rb->tail > rb->peek ? rb->tail : rb->size;
+        for ( i = 1; i < n && rb->peek + i < end && rb->state[ rb->peek + i ] != RB_VOID; i++ )
+            ;
+        n = i;
+        *slots = RB_SLOT( rb, rb->peek );
+        rb->peek = (rb->peek + n) % rb->size;
+        PVC_PROBE( rb_peek, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+    } else {
+        *slots = NULL;
+        n = 0;
+    }
+    profiled_mutex_unlock( mutex );
+
+    _rb_wakeup( &rb->not_full, to_signal );
+
+    return n;
+}
+/* give back n slots handed by ring_buffer_peek(), starting at slots */
+void ring_buffer_release( ring_buffer_t *rb, void *slots, size_t n )
+{
+    profiled_mutex_t * const mutex = &rb->mutex;
+    const size_t first = RB_INDEX( rb, slots );
+    size_t to_signal;
+
+    assert( first + n <= rb->size );
+
+    profiled_mutex_lock( mutex );
+    memset( &rb->state[ first ], RB_RELEASED, n );
+    to_signal = _rb_advance_head( rb );
+    PVC_PROBE( rb_release, rb->id, _pvc_probe_index(), RB_OCCUPANCY( rb ) );
+    RB_SAMPLE( rb );
+    profiled_mutex_unlock( mutex );
+
+    _rb_wakeup( &rb->not_full, to_signal );
+}
+
+#define PVC_HUGE_PAGE_SIZE (2UL << 20)
+
+/*
+ * memory for rings and pools, see pvc_set_memory(). with no flags it
+ * comes from the heap and *mapped is 0, otherwise it is mapped, and
+ * *mapped is the length to unmap. contents are zeroed.
+ */
+static void * _pvc_mem_alloc( size_t size, int flags, size_t *mapped )
+{
+    const size_t page = sysconf( _SC_PAGESIZE );
+    char * p = MAP_FAILED;
+    size_t len, i;
+
+    *mapped = 0;
+
+    if ( !flags ) {
+        void * mem;
+
+        if ( posix_memalign( &mem, 64, size ) )
+            return NULL;
+        return memset( mem, 0, size );
+    }
+
+#ifdef MAP_HUGETLB
+    // from the hugetlbfs pool, if the admin has reserved any
+    if ( flags & PVC_MEM_HUGETLB ) {
+        len = ( size + PVC_HUGE_PAGE_SIZE - 1 ) & ~( PVC_HUGE_PAGE_SIZE - 1 );
+        p = mmap( NULL, len, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0 );
+    }
+#endif
+    if ( p == MAP_FAILED ) {
+        len = ( size + page - 1 ) & ~( page - 1 );
+#ifdef MADV_HUGEPAGE
+        // align on huge pages for the kernel to back them with
+        if ( ( flags & (PVC_MEM_HUGETLB|PVC_MEM_THP) ) && len >= PVC_HUGE_PAGE_SIZE ) {
+            char * const raw = mmap( NULL, len + PVC_HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE,
+                                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+
+            if ( raw != MAP_FAILED ) {
+                const size_t lead = ( PVC_HUGE_PAGE_SIZE - (uintptr_t)raw % PVC_HUGE_PAGE_SIZE ) % PVC_HUGE_PAGE_SIZE;
+
+                if ( lead )
+                    munmap( raw, lead );
+                munmap( raw + lead + len, PVC_HUGE_PAGE_SIZE - lead );
+                p = raw + lead;
+                madvise( p, len, MADV_HUGEPAGE );
+            }
+        }
+#endif
+        if ( p == MAP_FAILED )
+            p = mmap( NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+            return NULL;
+    }
+
+    // fault every page in now rather than on the first ring operation
+    if ( flags & (PVC_MEM_PREFAULT|PVC_MEM_LOCK) ) {
+        for ( i = 0; i < len; i += page )
+            ((volatile char *)p)[i] = 0;
+    }
+    if ( ( flags & PVC_MEM_LOCK ) && mlock( p, len ) )
+        printf( "memory:\tmlock of %zu bytes failed, not locked\n", len );
+
+    *mapped = len;
+    return p;
+}
+static void _pvc_mem_free( void *mem, size_t mapped )
+{
+    if ( mapped )
+        munmap( mem, mapped );
+    else
+        free( mem );
+}
+
+static elem_pool_t * elem_pool_create( size_t elem_size, size_t n_elems, int mem_flags )
+{
+    elem_pool_t * const pool = calloc( 1, sizeof(elem_pool_t) );
+    size_t i;
+
+    if ( !pool )
+        return NULL;
+
+    // keep every element aligned for any type, the free stack follows
+    pool->elem_size = ( elem_size + 15 ) & ~(size_t)15;
+    pool->n_elems = n_elems;
+    pool->mem = _pvc_mem_alloc( ( pool->elem_size + sizeof(void*) ) * n_elems,
+                                mem_flags, &pool->mem_len );
+    if ( !pool->mem ) {
+        free( pool );
+        return NULL;
+    }
+    pool->free_elems = (void**)( pool->mem + pool->elem_size * n_elems );
+
+    // hand out low addresses first
+    for ( i = 0; i < n_elems; i++ )
+        pool->free_elems[i] = pool->mem + ( n_elems - 1 - i ) * pool->elem_size;
+    pool->n_free = n_elems;
+
+    profiled_mutex_init( &pool->mutex, "pool" );
+
+    return pool;
+}
+static void elem_pool_destroy( elem_pool_t *pool )
+{
+    if ( !pool )
+        return;
+
+    pthread_mutex_destroy( &pool->mutex.mutex );
+    _pvc_mem_free( pool->mem, pool->mem_len );
+    free( pool );
+}
+static inline int elem_pool_owns( elem_pool_t *pool, void *elem )
+{
+    const char * const p = elem;
+
+    return p >= pool->mem && p < pool->mem + pool->elem_size * pool->n_elems &&
+           ( p - pool->mem ) % pool->elem_size == 0;
+}
+/* take up to n free elements, return how many were taken */
+static unsigned int elem_pool_take( elem_pool_t *pool, void **elems, unsigned int n )
+{
+    unsigned int i;
+
+    profiled_mutex_lock( &pool->mutex );
+    if ( n > pool->n_free )
+        n = pool->n_free;
+    for ( i = 0; i < n; i++ )
+        elems[i] = pool->free_elems[ --pool->n_free ];
+    profiled_mutex_unlock( &pool->mutex );
+
+    return n;
+}
+static void elem_pool_give( elem_pool_t *pool, void * const *elems, unsigned int n )
+{
+    unsigned int i;
+
+    profiled_mutex_lock( &pool->mutex );
+    assert( pool->n_free + n <= pool->n_elems );
+    for ( i = 0; i < n; i++ )
+        pool->free_elems[ pool->n_free++ ] = elems[i];
+    profiled_mutex_unlock( &pool->mutex );
+}
+static void pool_cache_flush( pool_cache_t *cache )
+{
+    if ( cache->pool && cache->n > 0 )
+        elem_pool_give( cache->pool, cache->elems, cache->n );
+    cache->n = 0;
+    cache->pool = NULL;
+}
+
+static void _pvc_init_once( void )
+{
+    pthread_key_create( &_pvc_info_key, NULL );
+}
+
+#ifdef __linux__
+static const struct {
+    unsigned int type;
+    unsigned long long config;
+} _pvc_perf_events[ PVC_PERF_NR ] = {
+    [PVC_PERF_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PVC_PERF_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PVC_PERF_CACHE_MISSES]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PVC_PERF_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+#endif
+
+/*
+ * perf state is shared with pvc_get_thread_stats() callers, under the
+ * mutex_perf of the context's PVC: a counter is not read once closed.
+ */
+
+/* open counters for the calling thread, any of them may fail */
+static void _pvc_perf_open( thread_context_t *ctx )
+{
+#ifdef __linux__
+    struct rusage ru;
+    int i;
+
+    pthread_mutex_lock( &ctx->pvc->mutex_perf );
+    for ( i = 0; i < PVC_PERF_NR; i++ ) {
+        struct perf_event_attr attr;
+        int fd;
+
+        memset( &attr, 0, sizeof(attr) );
+        attr.size = sizeof(attr);
+        attr.type = _pvc_perf_events[i].type;
+        attr.config = _pvc_perf_events[i].config;
+        // context switches happen in kernel, the others are counted in
+        // user mode only so that they work with perf_event_paranoid=2
+        attr.exclude_kernel = attr.type == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+
+        fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+        ctx->perf_fd[i] = fd;
+        if ( fd >= 0 )
+            ctx->perf_open |= 1u << i;
+    }
+
+    // context switches are always available from rusage
+    // a new thread may well have none yet, hence the flag
+    if ( !( ctx->perf_open & (1u << PVC_PERF_CONTEXT_SWITCHES) ) &&
+         getrusage( RUSAGE_THREAD, &ru ) == 0 ) {
+        ctx->perf_nvcsw = ru.ru_nvcsw + ru.ru_nivcsw;
+        ctx->perf_rusage = 1;
+    }
+    pthread_mutex_unlock( &ctx->pvc->mutex_perf );
+#endif
+}
+/* sample opened counters, from any thread holding mutex_perf */
+static void _pvc_perf_read( thread_context_t *ctx )
+{
+#ifdef __linux__
+    const unsigned int open = ctx->perf_open;
+    unsigned long long value;
+    int i;
+
+    for ( i = 0; i < PVC_PERF_NR; i++ ) {
+        if ( !( open & (1u << i) ) )
+            continue;
+        if ( read( ctx->perf_fd[i], &value, sizeof(value) ) == sizeof(value) ) {
+            ctx->perf[i] = value;
+            ctx->perf_valid |= 1u << i;
+        }
+    }
+#endif
+}
+/* final sample and close, must run on the counted thread */
+static void _pvc_perf_close( thread_context_t *ctx )
+{
+#ifdef __linux__
+    struct rusage ru;
+    int i;
+
+    pthread_mutex_lock( &ctx->pvc->mutex_perf );
+    _pvc_perf_read( ctx );
+
+    ctx->perf_open = 0;
+    for ( i = 0; i < PVC_PERF_NR; i++ ) {
+        if ( ctx->perf_fd[i] >= 0 )
+            close( ctx->perf_fd[i] );
+    }
+
+    if ( ctx->perf_rusage && getrusage( RUSAGE_THREAD, &ru ) == 0 ) {
+        ctx->perf[ PVC_PERF_CONTEXT_SWITCHES ] = ru.ru_nvcsw + ru.ru_nivcsw - ctx->perf_nvcsw;
+        ctx->perf_valid |= 1u << PVC_PERF_CONTEXT_SWITCHES;
+    }
+    ctx->perf_rusage = 0;
+    pthread_mutex_unlock( &ctx->pvc->mutex_perf );
+#endif
+}
+
+/* the role of a thread for its attributes, the cleaner is a consumer */
+static int _pvc_thread_role( pvc_type_t type )
+{
+    return type == PVC_PRODUCER ? 0 : type == PVC_CONSUMER ? 1 : 2;
+}
+/*
+ * expand the pattern of pvc_set_thread_name(): %i the PVC id, %r the
+ * role letter, %n the index in the role, %% a percent sign.
+ */
+static void _pvc_thread_name( const thread_context_t *ctx, char *name, size_t len )
+{
+    const char * p;
+    size_t n = 0;
+
+    for ( p = ctx->pvc->thread_name; *p && n + 1 < len; p++ ) {
+        if ( *p != '%' || !p[1] ) {
+            name[ n++ ] = *p;
+            continue;
+        }
+        switch ( *++p ) {
+        case 'i':
+            n += snprintf( name + n, len - n, "%u", ctx->pvc->id );
+            break;
+        case 'r':
+            name[ n++ ] = ctx->info.type == PVC_PRODUCER ? 'P' : 'C';
+            break;
+        case 'n':
+            n += snprintf( name + n, len - n, "%u", ctx->info.sub_index );
+            break;
+        default:
+            name[ n++ ] = *p;
+        }
+    }
+    name[ C_min( n, len - 1 ) ] = '\0';
+}
+static int _pvc_thread_create( thread_context_t *ctx, void *(*routine)( void * ) )
+{
+    pvc_t const pvc = ctx->pvc;
+    const int role = _pvc_thread_role( ctx->info.type );
+    size_t stack_size = pvc->thread_attr[ role ].stack_size;
+    const size_t guard_size = pvc->thread_attr[ role ].guard_size;
+    pthread_attr_t attr;
+    int ret;
+
+    if ( !stack_size && !guard_size )
+        return pthread_create( &ctx->tid, NULL, routine, ctx );
+
+    pthread_attr_init( &attr );
+    if ( stack_size ) {
+        const size_t page = sysconf( _SC_PAGESIZE );
+
+        stack_size = C_max( stack_size, (size_t)PTHREAD_STACK_MIN );
+        pthread_attr_setstacksize( &attr, ( stack_size + page - 1 ) & ~( page - 1 ) );
+    }
+    if ( guard_size )
+        pthread_attr_setguardsize( &attr, guard_size );
+    ret = pthread_create( &ctx->tid, &attr, routine, ctx );
+    pthread_attr_destroy( &attr );
+
+    return ret;
+}
+
+static void _pvc_thread_enter( thread_context_t *ctx )
+{
+    size_t slot_size = ctx->ring_buffer->slot_size;
+
+    pthread_setspecific( _pvc_info_key, &ctx->info );
+
+#ifdef __linux__
+    // as seen by top -H, perf and gdb, at most 15 characters
+    if ( ctx->pvc->thread_name[0] ) {
+        char name[16];
+
+        _pvc_thread_name( ctx, name, sizeof(name) );
+        pthread_setname_np( pthread_self(), name );
+    }
+#endif
+
+    // value mode: the element being copied out by chains and the
+    // cleaner (index 0), or appended by producers under an overflow
+    // policy or conflation, and the one evicted; others work in ring
+    // slots
+    if ( ( ctx->info.type == PVC_PRODUCER &&
+           !ctx->ring_buffer->overflow && !ctx->ring_buffer->conflating ) ||
+         ( ctx->info.type == PVC_CONSUMER && ctx->info.index ) )
+        slot_size = 0;
+    else if ( ctx->info.type == PVC_CHAINED_CONSUMER )
+        slot_size = C_max( slot_size, ctx[1].ring_buffer->slot_size );
+    if ( slot_size ) {
+        slot_size = ( slot_size + 15 ) & ~(size_t)15;
+        ctx->slot_buf = malloc( 2 * slot_size );
+        assert( ctx->slot_buf );
+        ctx->evict_buf = (char *)ctx->slot_buf + slot_size;
+    }
+
+    if ( ctx->pvc && ctx->pvc->perf_enabled )
+        _pvc_perf_open( ctx );
+}
+static void _pvc_thread_leave( thread_context_t *ctx )
 {
-    pthread_mutex_t * const mutex = &rb->mutex;
-    size_t tmp;
-    int result;
+    if ( ctx->pvc && ctx->pvc->perf_enabled )
+        _pvc_perf_close( ctx );
 
-    pthread_mutex_lock( mutex );
-    tmp = rb->tail + 1 + rb->size - rb->head;
-    result = (tmp == 0 || tmp == rb->size) ? 1 : 0;
-    pthread_mutex_unlock( mutex );
+    pool_cache_flush( &ctx->pool_cache );
+    if ( ctx->info.type == PVC_CHAINED_CONSUMER )
+        pool_cache_flush( &ctx[1].pool_cache );
 
-    return result;
+    free( ctx->slot_buf );
+    ctx->slot_buf = NULL;
 }
-int ring_buffer_prepend( ring_buffer_t *rb, void *data )
-{
-    pthread_mutex_t * const mutex = &rb->mutex;
-    int to_signal = 0;
 
-    pthread_mutex_lock( mutex );
-    if ( (rb->tail + 1) % rb->size == rb->head ) {
-        rb->user_count++;
-        pthread_cond_wait( &rb->not_full, mutex );
-        rb->user_count--;
-    }
-    if ( (rb->tail + 1) % rb->size != rb->head ) {
-        rb->head = (rb->head + rb->size - 1) % rb->size;
-        rb->elems[ rb->head ] = data;
-        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->head, data );
-        to_signal = 1;
+/*
+ * cache of the calling thread for a pool, NULL outside PVC threads.
+ * a thread has one cache per context, bound to the first pool it
+ * touches: chained threads have two.
+ */
+static pool_cache_t * _pvc_pool_cache( elem_pool_t *pool )
+{
+    pvc_info_t * const info = pthread_getspecific( _pvc_info_key );
+    thread_context_t * ctx;
+    int i, n;
+
+    if ( !info )
+        return NULL;
+
+    ctx = (thread_context_t *)( (char *)info - offsetof( thread_context_t, info ) );
+    n = ctx->info.type == PVC_CHAINED_CONSUMER ? 2 : 1;
+    for ( i = 0; i < n; i++ ) {
+        pool_cache_t * const cache = &ctx[i].pool_cache;
+        if ( cache->pool == pool )
+            return cache;
+        if ( cache->pool == NULL ) {
+            cache->pool = pool;
+            return cache;
+        }
     }
-    pthread_mutex_unlock( mutex );
 
-    if ( to_signal )
-        pthread_cond_signal( &rb->not_empty );
+    return NULL;
+}
 
-    return 0;
+/* service time of one callback, on wall and thread cpu clocks */
+static inline void _pvc_service_begin( struct timespec ts[2] )
+{
+    clock_gettime( CLOCK_MONOTONIC, &ts[0] );
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts[1] );
 }
-int ring_buffer_append( ring_buffer_t *rb, void *data )
+static inline void _pvc_service_end( thread_context_t *ctx, const struct timespec ts[2] )
 {
-    pthread_mutex_t * const mutex = &rb->mutex;
-    int to_signal = 0;
-
-    pthread_mutex_lock( mutex );
-    if ( (rb->tail + 1) % rb->size == rb->head ) {
-        rb->user_count++;
-        pthread_cond_wait( &rb->not_full, mutex );
-        rb->user_count--;
-    }
-    if ( (rb->tail + 1) % rb->size != rb->head ) {
-        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->tail, data );
-        rb->elems[ rb->tail ] = data;
-        rb->tail = (rb->tail + 1) % rb->size;
-        to_signal = 1;
-    }
-    pthread_mutex_unlock( mutex );
+    struct timespec now;
 
-    if ( to_signal )
-        pthread_cond_signal( &rb->not_empty );
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    ctx->service_ns += _pvc_elapsed_ns( &ts[0], &now );
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+    ctx->service_cpu_ns += _pvc_elapsed_ns( &ts[1], &now );
+}
 
-    return 0;
+static void _pvc_get_thread_stats( thread_context_t *ctx, pvc_thread_stats_t *stats )
+{
+    pthread_mutex_lock( &ctx->pvc->mutex_perf );
+    if ( ctx->perf_open )
+        _pvc_perf_read( ctx );
+    stats->perf_valid = ctx->perf_valid;
+    memcpy( stats->perf, ctx->perf, sizeof(stats->perf) );
+    pthread_mutex_unlock( &ctx->pvc->mutex_perf );
+
+    stats->info = ctx->info;
+    stats->service_ns = ctx->service_ns;
+    stats->service_cpu_ns = ctx->service_cpu_ns;
 }
-void * ring_buffer_pop( ring_buffer_t *rb )
+/* keep the stats of a joined thread for pvc_get_thread_stats() */
+static void _pvc_save_thread_stats( pvc_t pvc, thread_context_t *ctx )
 {
-    pthread_mutex_t * const mutex = &rb->mutex;
-    int to_signal = 0;
-    void * data = NULL;
+    pvc_thread_stats_t * const stats = malloc( sizeof(pvc_thread_stats_t) );
 
-    pthread_mutex_lock( mutex );
-    if ( rb->head == rb->tail ) {
-        rb->user_count++;
-        pthread_cond_wait( &rb->not_empty, mutex );
-        rb->user_count--;
-    }
-    if ( rb->head != rb->tail ) {
-        data = rb->elems[ rb->head ];
-        //printf( "rb: %s elems[%zd]=%p\n", __func__+12, rb->head, data );
-        rb->head = (rb->head + 1) % rb->size;
-        to_signal = 1;
-    }
-    pthread_mutex_unlock( mutex );
+    assert( stats );
 
-    if ( to_signal )
-        pthread_cond_signal( &rb->not_full );
+    _pvc_get_thread_stats( ctx, stats );
+    C_linklist_append( pvc->stopped_stats, stats );
 
-    return data;
-}
+    if ( ctx->perf_valid ) {
+        static const char * const names[ PVC_PERF_NR ] = {
+            "cycles", "instructions", "cache-misses", "context-switches",
+        };
+        int i;
 
-static void _pvc_init_once( void )
-{
-    pthread_key_create( &_pvc_info_key, NULL );
+        printf( "stop:\tthread #%d(%c%d):", ctx->info.index,
+                ctx->info.type == PVC_PRODUCER ? 'P' : 'C', ctx->info.sub_index );
+        for ( i = 0; i < PVC_PERF_NR; i++ ) {
+            if ( ctx->perf_valid & (1u << i) )
+                printf( " %s=%llu", names[i], ctx->perf[i] );
+        }
+        printf( "\n" );
+    }
 }
 
 void pvc_close( pvc_t pvc )
@@ -174,39 +1406,122 @@ void pvc_close( pvc_t pvc )
         return;
 
     pthread_mutex_destroy( &pvc->mutex_inited );
-    pthread_mutex_destroy( &pvc->mutex_producer );
-    pthread_mutex_destroy( &pvc->mutex_consumer );
+    pthread_mutex_destroy( &pvc->mutex_perf );
+    pthread_mutex_destroy( &pvc->mutex_producer.mutex );
+    pthread_mutex_destroy( &pvc->mutex_consumer.mutex );
 
-    pthread_mutex_destroy( &pvc->ring_buffer.mutex );
+    pthread_mutex_destroy( &pvc->ring_buffer.mutex.mutex );
     pthread_cond_destroy( &pvc->ring_buffer.not_empty );
     pthread_cond_destroy( &pvc->ring_buffer.not_full );
 
     C_linklist_destroy( pvc->thread_contexts );
+    C_linklist_destroy( pvc->stopped_stats );
+
+    elem_pool_destroy( pvc->pool );
+    free( pvc->ring_buffer.elem_bytes );
+    free( pvc->ring_buffer.deadlines );
+    free( pvc->ring_buffer.key_map );
+    free( pvc->ring_buffer.keys );
+    C_queue_destroy( pvc->ring_buffer.queue );
+
+    if ( pvc->rb_mem )
+        _pvc_mem_free( pvc->rb_mem, pvc->rb_mem_len );
 
     free( pvc );
 }
-pvc_t pvc_open( size_t max_elems )
+/* lay the ring out on mem, which is zeroed */
+static void _pvc_ring_bind( ring_buffer_t *rb, char *mem )
+{
+    if ( rb->slot_size ) {
+        rb->slots = mem;
+        rb->state = (unsigned char*)mem + rb->size * rb->stride;
+    } else if ( rb->handles ) {
+        rb->handles = (uint32_t*)mem;
+    } else {
+        rb->elems = (void**)mem;
+    }
+    rb->head = rb->tail = rb->peek = rb->reserve = 0;
+}
+/* a ring of slots in value mode, else of pointers or stride-sized handles */
+static pvc_t _pvc_open( size_t max_elems, size_t slot_size, size_t stride )
 {
-    size_t rb_size = (max_elems + 1) * sizeof(((ring_buffer_t*)NULL)->elems[0]);
-    pvc_t pvc = calloc( 1, sizeof( struct pvc_s ) + rb_size );
+    size_t rb_size;
+    pvc_t pvc;
+
+    if ( slot_size )
+        stride = ( slot_size + sizeof(void*) - 1 ) & ~( sizeof(void*) - 1 );
+    else if ( !stride )
+        stride = sizeof(((ring_buffer_t*)NULL)->elems[0]);
+
+    rb_size = (max_elems + 1) * stride + (slot_size ? max_elems + 1 : 0);
+    pvc = calloc( 1, sizeof( struct pvc_s ) + rb_size );
 
     assert( pvc );
 
     pthread_once( &_pvc_once, _pvc_init_once );
 
+    pvc->id = __sync_add_and_fetch( &_pvc_last_id, 1 );
+
     pvc->thread_contexts = C_linklist_create();
     C_linklist_set_destructor( pvc->thread_contexts, free );
     assert( pvc->thread_contexts );
 
-    pvc->ring_buffer.elems = (void**)&pvc[1];
+    pvc->stopped_stats = C_linklist_create();
+    C_linklist_set_destructor( pvc->stopped_stats, free );
+    assert( pvc->stopped_stats );
+
+    pvc->ring_buffer.slot_size = slot_size;
+    pvc->ring_buffer.stride = stride;
     pvc->ring_buffer.size = max_elems + 1;
-    pthread_mutex_init( &pvc->ring_buffer.mutex, NULL );
+    _pvc_ring_bind( &pvc->ring_buffer, (char*)&pvc[1] );
+    pvc->ring_buffer.id = pvc->id;
+    profiled_mutex_init( &pvc->ring_buffer.mutex, "ring" );
     pthread_cond_init( &pvc->ring_buffer.not_empty, NULL );
     pthread_cond_init( &pvc->ring_buffer.not_full, NULL );
 
     pthread_mutex_init( &pvc->mutex_inited, NULL );
-    pthread_mutex_init( &pvc->mutex_producer, NULL );
-    pthread_mutex_init( &pvc->mutex_consumer, NULL );
+    pthread_mutex_init( &pvc->mutex_perf, NULL );
+    profiled_mutex_init( &pvc->mutex_producer, "producer" );
+    profiled_mutex_init( &pvc->mutex_consumer, "consumer" );
+
+    strcpy( pvc->thread_name, "pvc%i-%r%n" );
+
+    return pvc;
+}
+pvc_t pvc_open( size_t max_elems )
+{
+    pvc_t pvc = _pvc_open( max_elems, 0, 0 );
+
+    // the ring is left empty, elements go through the queue
+    if ( max_elems == PVC_UNBOUNDED ) {
+        pvc->ring_buffer.queue = C_queue_create();
+        assert( pvc->ring_buffer.queue );
+    }
+
+    return pvc;
+}
+pvc_t pvc_open_slots( size_t max_elems, size_t slot_size )
+{
+    if ( max_elems == PVC_UNBOUNDED )
+        return NULL;
+
+    return _pvc_open( max_elems, slot_size, 0 );
+}
+pvc_t pvc_open_slab( size_t max_elems, size_t elem_size, size_t n_elems )
+{
+    pvc_t pvc;
+
+    if ( max_elems == PVC_UNBOUNDED || elem_size == 0 || n_elems == 0 || n_elems > UINT32_MAX )
+        return NULL;
+
+    pvc = _pvc_open( max_elems, 0, sizeof(uint32_t) );
+    pvc->ring_buffer.handles = (uint32_t*)pvc->ring_buffer.elems;
+    pvc->ring_buffer.elems = NULL;
+
+    if ( pvc_set_pool( pvc, elem_size, n_elems ) ) {
+        pvc_close( pvc );
+        return NULL;
+    }
 
     return pvc;
 }
@@ -215,6 +1530,49 @@ const pvc_info_t * pvc_get_info( void )
 {
     return (const pvc_info_t *) pthread_getspecific( _pvc_info_key );
 }
+static rb_meta_t * _pvc_meta( void )
+{
+    pvc_info_t * const info = pthread_getspecific( _pvc_info_key );
+
+    return info ? &( (thread_context_t *)( (char *)info - offsetof( thread_context_t, info ) ) )->meta : NULL;
+}
+void pvc_declare_size( size_t bytes )
+{
+    rb_meta_t * const meta = _pvc_meta();
+
+    if ( meta )
+        meta->bytes = bytes;
+}
+void pvc_declare_ttl( unsigned long long ttl_ns )
+{
+    rb_meta_t * const meta = _pvc_meta();
+
+    if ( meta )
+        meta->deadline = ttl_ns ? _pvc_now_ns() + ttl_ns : 0;
+}
+void pvc_declare_deadline( const struct timespec *deadline )
+{
+    rb_meta_t * const meta = _pvc_meta();
+
+    if ( meta )
+        meta->deadline = deadline ? deadline->tv_sec * 1000000000ULL + deadline->tv_nsec : 0;
+}
+
+/* hand an element the PVC gives up on to the discard function */
+static inline void _pvc_discard( pvc_t pvc, void *arg, void *data )
+{
+    if ( pvc->discard )
+        pvc->discard( arg, data );
+}
+/* and the ones expired in the ring */
+static void _pvc_discard_expired( thread_context_t *ctx, void *arg )
+{
+    unsigned int i;
+
+    for ( i = 0; i < ctx->expired.n; i++ )
+        _pvc_discard( ctx->pvc, arg, ctx->expired.elems[i] );
+    ctx->expired.n = 0;
+}
 
 static void * _pvc_producer_thread( void *args )
 {
@@ -223,29 +1581,69 @@ static void * _pvc_producer_thread( void *args )
     pvc_cb_produce_func_t produce = ctx->callback;
     void * const arg = ctx->arg;
     pvc_info_t * const info = &ctx->info;
+    const int timing = ctx->pvc->stage_profiling;
+    struct timespec ts[2];
     void * data = NULL;
+    int ret;
 
-    pthread_setspecific( _pvc_info_key, info );
+    _pvc_thread_enter( ctx );
 
     pthread_mutex_lock( ctx->inited_mutex );
     pthread_mutex_unlock( ctx->inited_mutex );
 
     while ( data || ( *ctx->status & PVC_STATUS_PRODUCER_RUNNING ) ) {
         if ( !data ) {
-            pthread_mutex_lock( ctx->callback_mutex );
-            produce( arg, &data );
-            pthread_mutex_unlock( ctx->callback_mutex );
+            void * slot = NULL;
+
+            // in value mode, produce right into a ring slot, unless
+            // the overflow policy is to drop or evict elements, or
+            // elements are conflated
+            if ( rb->slot_size && !rb->overflow && !rb->conflating &&
+                 ring_buffer_reserve( rb, &slot, 1 ) == 0 )
+                continue;
+
+            data = slot ? slot : ctx->slot_buf;
+            ctx->meta.bytes = 0;
+            ctx->meta.deadline = 0;
+            profiled_mutex_lock( ctx->callback_mutex );
+            PVC_PROBE( produce_entry, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            if ( timing )
+                _pvc_service_begin( ts );
+            ret = produce( arg, &data );
+            if ( timing )
+                _pvc_service_end( ctx, ts );
+            if ( ret && rb->slot_size )
+                data = NULL;
+            if ( data && rb->conflating )
+                ctx->meta.key = ctx->pvc->key( arg, data );
+            PVC_PROBE( produce_return, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            profiled_mutex_unlock( ctx->callback_mutex );
             info->n_round++;
             if ( data/* FIXME: succeed */ )
                 info->n_elem++;
+            if ( slot ) {
+                if ( data && data != slot )
+                    memcpy( slot, data, rb->slot_size );
+                ring_buffer_commit( rb, slot, data ? 1 : 0, &ctx->meta );
+                data = NULL;
+            }
         } else {
-            ring_buffer_append( rb, data );
-            data = NULL;
+            void * evicted = ctx->evict_buf;
+
+            ret = ring_buffer_append( rb, data, &ctx->meta, &evicted );
+            if ( evicted )
+                _pvc_discard( ctx->pvc, arg, evicted );
+            if ( ret > 0 )
+                _pvc_discard( ctx->pvc, arg, data );
+            if ( ret >= 0 )
+                data = NULL;
         }
     }
 
     assert( data == NULL );
 
+    _pvc_thread_leave( ctx );
+
     return NULL;
 }
 static void * _pvc_chain_thread( void *args )
@@ -258,30 +1656,51 @@ static void * _pvc_chain_thread( void *args )
     void * const arg = src_ctx->arg;
     pvc_info_t * const src_info = &src_ctx->info;
     pvc_info_t * const dst_info = &dst_ctx->info;
+    const int timing = src_ctx->pvc->stage_profiling;
+    struct timespec ts[2];
     void * data = NULL;
+    int ret;
 
-    pthread_setspecific( _pvc_info_key, src_info );
+    _pvc_thread_enter( src_ctx );
 
     while ( data ||
             ( ( *src_ctx->status & PVC_STATUS_CONSUMER_RUNNING ) &&
               ( *dst_ctx->status & PVC_STATUS_PRODUCER_RUNNING ) ) ) {
         if ( !data ) {
-            data = ring_buffer_pop( src_rb );
+            // unless declared again, size and deadline are kept along the chain
+            data = ring_buffer_pop( src_rb, src_ctx->slot_buf, &src_ctx->meta, &src_ctx->expired );
+            if ( src_ctx->expired.n )
+                _pvc_discard_expired( src_ctx, arg );
             if ( data ) {
                 if ( chain ) {
-                    pthread_mutex_lock( src_ctx->callback_mutex );
+                    profiled_mutex_lock( src_ctx->callback_mutex );
+                    PVC_PROBE( chain_entry, src_rb->id, src_info->index, RB_OCCUPANCY( src_rb ) );
+                    if ( timing )
+                        _pvc_service_begin( ts );
                     chain( arg, &data );
-                    pthread_mutex_unlock( src_ctx->callback_mutex );
+                    if ( timing )
+                        _pvc_service_end( src_ctx, ts );
+                    PVC_PROBE( chain_return, dst_rb->id, src_info->index, RB_OCCUPANCY( dst_rb ) );
+                    profiled_mutex_unlock( src_ctx->callback_mutex );
                 }
+                if ( data && dst_rb->conflating )
+                    src_ctx->meta.key = dst_ctx->pvc->key( arg, data );
                 src_info->n_round++;
                 if ( data/* FIXME: succeed */ )
                     src_info->n_elem++;
             }
         } else {
-            dst_info->n_round++;
-            if ( data ) {
-                dst_info->n_elem++;
-                ring_buffer_append( dst_rb, data );
+            void * evicted = src_ctx->evict_buf;
+
+            ret = ring_buffer_append( dst_rb, data, &src_ctx->meta, &evicted );
+            if ( evicted )
+                _pvc_discard( dst_ctx->pvc, arg, evicted );
+            if ( ret > 0 )
+                _pvc_discard( dst_ctx->pvc, arg, data );
+            if ( ret >= 0 ) {
+                dst_info->n_round++;
+                if ( ret == 0 )
+                    dst_info->n_elem++;
                 data = NULL;
             }
         }
@@ -289,6 +1708,8 @@ static void * _pvc_chain_thread( void *args )
 
     assert( data == NULL );
 
+    _pvc_thread_leave( src_ctx );
+
     return NULL;
 }
 static void * _pvc_consumer_thread( void *args )
@@ -298,23 +1719,39 @@ static void * _pvc_consumer_thread( void *args )
     pvc_cb_consume_func_t consume = ctx->callback;
     void * const arg = ctx->arg;
     pvc_info_t * const info = &ctx->info;
+    const int timing = ctx->pvc->stage_profiling;
+    struct timespec ts[2];
     void * data = NULL;
 
-    pthread_setspecific( _pvc_info_key, info );
+    _pvc_thread_enter( ctx );
 
     pthread_mutex_lock( ctx->inited_mutex );
     pthread_mutex_unlock( ctx->inited_mutex );
 
     while ( data || ( *ctx->status & PVC_STATUS_CONSUMER_RUNNING ) ) {
         if ( !data ) {
-            data = ring_buffer_pop( rb );
+            // in value mode, consume right from the ring slot
+            if ( rb->slot_size )
+                ring_buffer_peek( rb, &data, 1 );
+            else
+                data = ring_buffer_pop( rb, NULL, NULL, &ctx->expired );
+            if ( ctx->expired.n )
+                _pvc_discard_expired( ctx, arg );
             printf( "    \tthread #%d(C%d): tid=%p, poped %d\n", info->index, info->sub_index, pthread_self(), data?*(int*)data:-1 );
         } else {
-            pthread_mutex_lock( ctx->callback_mutex );
+            profiled_mutex_lock( ctx->callback_mutex );
+            PVC_PROBE( consume_entry, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            if ( timing )
+                _pvc_service_begin( ts );
             consume( arg, data );
-            pthread_mutex_unlock( ctx->callback_mutex );
+            if ( timing )
+                _pvc_service_end( ctx, ts );
+            PVC_PROBE( consume_return, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            profiled_mutex_unlock( ctx->callback_mutex );
             info->n_round++;
             if ( 1/* FIXME: succeed */ ) {
+                if ( rb->slot_size )
+                    ring_buffer_release( rb, data, 1 );
                 data = NULL;
                 info->n_elem++;
             }
@@ -323,6 +1760,8 @@ static void * _pvc_consumer_thread( void *args )
 
     assert( data == NULL );
 
+    _pvc_thread_leave( ctx );
+
     return NULL;
 }
 static void * _pvc_cleaner_thread( void *args )
@@ -332,9 +1771,11 @@ static void * _pvc_cleaner_thread( void *args )
     void * const arg = ctx->arg;
     pvc_cb_consume_func_t consume = ctx->callback;
     pvc_info_t * const info = &ctx->info;
+    const int timing = ctx->pvc->stage_profiling;
+    struct timespec ts[2];
     void * data = NULL;
 
-    pthread_setspecific( _pvc_info_key, info );
+    _pvc_thread_enter( ctx );
 
     while ( data || ( *ctx->status & PVC_STATUS_CLEANNING ) ) {
         if ( ctx->ring_buffer->user_count > 0 ) {
@@ -346,11 +1787,19 @@ static void * _pvc_cleaner_thread( void *args )
                 pthread_cond_broadcast( &rb->not_empty );
             }
         } else if ( !data ) {
-            data = ring_buffer_pop( rb );
+            data = ring_buffer_pop( rb, ctx->slot_buf, NULL, &ctx->expired );
+            if ( ctx->expired.n )
+                _pvc_discard_expired( ctx, arg );
         } else {
-            pthread_mutex_lock( ctx->callback_mutex );
+            profiled_mutex_lock( ctx->callback_mutex );
+            PVC_PROBE( consume_entry, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            if ( timing )
+                _pvc_service_begin( ts );
             consume( arg, data );
-            pthread_mutex_unlock( ctx->callback_mutex );
+            if ( timing )
+                _pvc_service_end( ctx, ts );
+            PVC_PROBE( consume_return, rb->id, info->index, RB_OCCUPANCY( rb ) );
+            profiled_mutex_unlock( ctx->callback_mutex );
             info->n_round++;
             if ( 1/* FIXME: succeed */ ) {
                 data = NULL;
@@ -359,6 +1808,8 @@ static void * _pvc_cleaner_thread( void *args )
         }
     }
 
+    _pvc_thread_leave( ctx );
+
     return NULL;
 }
 thread_context_t * _pvc_start_cleaner( pvc_t pvc, pvc_cb_consume_func_t func, void *arg )
@@ -366,6 +1817,7 @@ thread_context_t * _pvc_start_cleaner( pvc_t pvc, pvc_cb_consume_func_t func, vo
     thread_context_t * const ctx = calloc( 1, sizeof( thread_context_t ) );
     int ret;
 
+    ctx->pvc = pvc;
     ctx->ring_buffer = &pvc->ring_buffer;
     ctx->callback = (void*)func;
     ctx->callback_mutex = &pvc->mutex_consumer;
@@ -379,7 +1831,7 @@ thread_context_t * _pvc_start_cleaner( pvc_t pvc, pvc_cb_consume_func_t func, vo
     assert( ! ( pvc->status & PVC_STATUS_CLEANNING ) );
     pvc->status |= PVC_STATUS_CLEANNING;
 
-    ret = pthread_create( &ctx->tid, NULL, _pvc_cleaner_thread, ctx );
+    ret = _pvc_thread_create( ctx, _pvc_cleaner_thread );
 
     return ctx;
 }
@@ -388,16 +1840,48 @@ int pvc_start( pvc_t pvc, void *arg )
 {
     c_linklist_t * const l = pvc->thread_contexts;
     thread_context_t * ctx;
+    c_link_t * p;
     int i, ret = 0;
 
     assert( ! ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) ) );
     pvc->status |= PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING;
 
+    // forget about threads of the last run
+    while ( C_linklist_length( pvc->stopped_stats ) > 0 )
+        free( C_linklist_pop( pvc->stopped_stats ) );
+
+    profiled_mutex_reset( &pvc->ring_buffer.mutex );
+    profiled_mutex_reset( &pvc->mutex_producer );
+    profiled_mutex_reset( &pvc->mutex_consumer );
+    if ( pvc->pool )
+        profiled_mutex_reset( &pvc->pool->mutex );
+
+    pvc->ring_buffer.occ_sum = pvc->ring_buffer.occ_samples = 0;
+    pvc->ring_buffer.occ_max = 0;
+    pvc->ring_buffer.max_bytes = pvc->ring_buffer.bytes;
+    pvc->ring_buffer.n_shed = 0;
+    pvc->ring_buffer.n_dropped = pvc->ring_buffer.n_evicted = 0;
+    pvc->ring_buffer.n_overflow = 0;
+    pvc->ring_buffer.n_expired = 0;
+    // nothing is dropped without a function to hand it to, but values
+    pvc->ring_buffer.shed = pvc->shed && pvc->discard;
+    pvc->ring_buffer.overflow = pvc->discard || pvc->ring_buffer.slot_size ?
+                                pvc->overflow : PVC_OVERFLOW_BLOCK;
+    pvc->ring_buffer.expiring = pvc->ring_buffer.deadlines &&
+                                ( pvc->discard || pvc->ring_buffer.slot_size );
+    pvc->ring_buffer.n_conflated = 0;
+    pvc->ring_buffer.conflating = pvc->key &&
+                                  ( pvc->discard || pvc->ring_buffer.slot_size );
+    if ( pvc->ring_buffer.conflating )
+        memset( pvc->ring_buffer.key_map, 0,
+                ( pvc->ring_buffer.key_mask + 1 ) * sizeof(uint32_t) );
+    clock_gettime( CLOCK_MONOTONIC, &pvc->started );
+
     pthread_mutex_lock( &pvc->mutex_inited );
 
-    for ( C_linklist_move_head( l ), i=0;
-          (ctx = C_linklist_restore( l )) != NULL;
-          C_linklist_move_next( l ), i++ ) {
+    for ( C_linklist_move_head_r( l, &p ), i=0;
+          (ctx = C_linklist_restore_r( l, &p )) != NULL;
+          C_linklist_move_next_r( l, &p ), i++ ) {
         char * const stype = ctx->info.type == PVC_PRODUCER ? "P" :
                              ctx->info.type == PVC_CONSUMER ? "C" :
                              "O";
@@ -408,12 +1892,12 @@ int pvc_start( pvc_t pvc, void *arg )
         switch ( ctx->info.type ) {
         case PVC_PRODUCER:
             ctx->info.sub_index = pvc->n_producer + 1;
-            ret = pthread_create( &ctx->tid, NULL, _pvc_producer_thread, ctx );
+            ret = _pvc_thread_create( ctx, _pvc_producer_thread );
             pvc->n_producer++;
             break;
         case PVC_CONSUMER:
             ctx->info.sub_index = pvc->n_consumer + 1;
-            ret = pthread_create( &ctx->tid, NULL, _pvc_consumer_thread, ctx );
+            ret = _pvc_thread_create( ctx, _pvc_consumer_thread );
             pvc->n_consumer++;
             break;
         case PVC_CHAINED_PRODUCER:
@@ -422,7 +1906,7 @@ int pvc_start( pvc_t pvc, void *arg )
             break;
         case PVC_CHAINED_CONSUMER:
             ctx->info.sub_index = pvc->n_consumer + 1;
-            ret = pthread_create( &ctx->tid, NULL, _pvc_chain_thread, ctx );
+            ret = _pvc_thread_create( ctx, _pvc_chain_thread );
             pvc->n_consumer++;
             break;
         default:
@@ -441,12 +1925,13 @@ static int _pvc_join_all( pvc_t pvc, pvc_type_t type )
 {
     c_linklist_t * const l = pvc->thread_contexts;
     thread_context_t * ctx;
+    c_link_t * p;
     int i, ret, n_threads = 0;
 
-    C_linklist_move_head( l );
-    for ( i=0; (ctx = C_linklist_restore( l )) != NULL; i++ ) {
+    C_linklist_move_head_r( l, &p );
+    for ( i=0; (ctx = C_linklist_restore_r( l, &p )) != NULL; i++ ) {
         if ( ctx->info.type != type ) {
-            C_linklist_move_next( l );
+            C_linklist_move_next_r( l, &p );
             continue;
         }
         switch ( type ) {
@@ -459,7 +1944,8 @@ static int _pvc_join_all( pvc_t pvc, pvc_type_t type )
 
                 printf( "stop:\tthread #%d(%s%d): tid=%p, round=%u, elems=%u\n", ctx->info.index, stype, ctx->info.sub_index, ctx->tid, ctx->info.n_round, ctx->info.n_elem );
 
-                C_linklist_delete( l );
+                _pvc_save_thread_stats( pvc, ctx );
+                C_linklist_delete_r( l, &p );
             }
             break;
         case PVC_CONSUMER:
@@ -471,7 +1957,8 @@ static int _pvc_join_all( pvc_t pvc, pvc_type_t type )
 
                 printf( "stop:\tthread #%d(%s%d): tid=%p, round=%u, elems=%u\n", ctx->info.index, stype, ctx->info.sub_index, ctx->tid, ctx->info.n_round, ctx->info.n_elem );
 
-                C_linklist_delete( l );
+                _pvc_save_thread_stats( pvc, ctx );
+                C_linklist_delete_r( l, &p );
             }
             break;
         case PVC_CHAINED_CONSUMER:
@@ -483,16 +1970,42 @@ static int _pvc_join_all( pvc_t pvc, pvc_type_t type )
 
                 printf( "stop:\tthread #%d(%s%d): tid=%p, round=%u, elems=%u\n", ctx->info.index, stype, ctx->info.sub_index, ctx->tid, ctx->info.n_round, ctx->info.n_elem );
 
-                C_linklist_delete( l );
+                _pvc_save_thread_stats( pvc, ctx );
+                C_linklist_delete_r( l, &p );
             }
             break;
         default:
-            C_linklist_move_next( l );
+            C_linklist_move_next_r( l, &p );
         }
     }
 
     return n_threads;
 }
+/* print the mutexes of a PVC, most waited first */
+static void _pvc_report_contention( pvc_t pvc )
+{
+    profiled_mutex_t * m[] = {
+        &pvc->ring_buffer.mutex, &pvc->mutex_producer, &pvc->mutex_consumer,
+        pvc->pool ? &pvc->pool->mutex : NULL,
+    };
+    const int n = pvc->pool ? 4 : 3;
+    int i, j;
+
+    for ( i = 1; i < n; i++ ) {
+        for ( j = i; j > 0 && m[j]->wait_ns > m[j-1]->wait_ns; j-- ) {
+            profiled_mutex_t * const t = m[j];
+            m[j] = m[j-1], m[j-1] = t;
+        }
+    }
+
+    printf( "stop:\tmutex contention of pvc #%u:\n", pvc->id );
+    for ( i = 0; i < n; i++ ) {
+        printf( "stop:\t%d. %-8s acquired=%llu, contended=%llu(%.1f%%), wait=%.3fms, max-wait=%.3fms, hold=%.3fms\n",
+                i + 1, m[i]->name, m[i]->n_acquire, m[i]->n_contended,
+                m[i]->n_acquire ? 100.0 * m[i]->n_contended / m[i]->n_acquire : 0.0,
+                m[i]->wait_ns * 1.0E-6, m[i]->max_wait_ns * 1.0E-6, m[i]->hold_ns * 1.0E-6 );
+    }
+}
 int pvc_stop( pvc_t pvc, pvc_cb_consume_func_t func, void *arg )
 {
     c_linklist_t * const l = pvc->thread_contexts;
@@ -526,8 +2039,11 @@ int pvc_stop( pvc_t pvc, pvc_cb_consume_func_t func, void *arg )
     assert( pvc->status & PVC_STATUS_CONSUMER_RUNNING );
     pvc->status &= ~PVC_STATUS_CONSUMER_RUNNING;
 
-    // unblock all consumer threads
+    // unblock all consumer threads, under the mutex for none of them
+    // to be between counting itself in user_count and waiting
+    profiled_mutex_lock( &pvc->ring_buffer.mutex );
     pthread_cond_broadcast( &pvc->ring_buffer.not_empty );
+    profiled_mutex_unlock( &pvc->ring_buffer.mutex );
 
     n_consumer = _pvc_join_all( pvc, PVC_CONSUMER );
     n_consumer += _pvc_join_all( pvc, PVC_CHAINED_CONSUMER );
@@ -539,26 +2055,36 @@ int pvc_stop( pvc_t pvc, pvc_cb_consume_func_t func, void *arg )
         assert( pvc->status & PVC_STATUS_CLEANNING );
         pvc->status &= ~PVC_STATUS_CLEANNING;
 
+        profiled_mutex_lock( &pvc->ring_buffer.mutex );
         pthread_cond_broadcast( &pvc->ring_buffer.not_empty );
+        profiled_mutex_unlock( &pvc->ring_buffer.mutex );
 
         ret = pthread_join( cleaner_ctx->tid, &cleaner_ctx->ret );
 
         printf( "stop:\tthread cleaner: tid=%p, round=%u, elems=%u\n", cleaner_ctx->tid, cleaner_ctx->info.n_round, cleaner_ctx->info.n_elem );
 
+        _pvc_save_thread_stats( pvc, cleaner_ctx );
+
         free( cleaner_ctx );
     }
 
+    clock_gettime( CLOCK_MONOTONIC, &pvc->stopped );
+
     printf( "stop:\ttotal: %d producers, %d consumers\n", n_producer, n_consumer );
 
+    if ( pvc->ring_buffer.mutex.profiling )
+        _pvc_report_contention( pvc );
+
     return 0;
 }
 
-static inline int _pvc_add_thread( pvc_t pvc, void *callback, pvc_type_t type, pthread_mutex_t *mutex )
+static inline int _pvc_add_thread( pvc_t pvc, void *callback, pvc_type_t type, profiled_mutex_t *mutex )
 {
     thread_context_t * const ctx = calloc( 1, sizeof( thread_context_t ) );
 
     assert( ctx );
 
+    ctx->pvc = pvc;
     ctx->ring_buffer = &pvc->ring_buffer;
     ctx->callback = callback;
     ctx->callback_mutex = mutex;
@@ -582,6 +2108,521 @@ int pvc_add_consumer( pvc_t pvc, pvc_cb_consume_func_t func, int count )
         _pvc_add_thread( pvc, (void*)func, PVC_CONSUMER, &pvc->mutex_consumer );
     return 0;
 }
+int pvc_set_thread_attr( pvc_t pvc, pvc_type_t type, size_t stack_size, size_t guard_size )
+{
+    int i;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    for ( i = 0; i < 3; i++ ) {
+        if ( type == _PVC_UNKNOWN_TYPE || _pvc_thread_role( type ) == i ) {
+            pvc->thread_attr[i].stack_size = stack_size;
+            pvc->thread_attr[i].guard_size = guard_size;
+        }
+    }
+    return 0;
+}
+int pvc_set_thread_name( pvc_t pvc, const char *pattern )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    if ( pattern && strlen( pattern ) >= sizeof(pvc->thread_name) )
+        return -1;
+
+    strcpy( pvc->thread_name, pattern ? pattern : "" );
+    return 0;
+}
+int pvc_set_perf_counters( pvc_t pvc, int enable )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    pvc->perf_enabled = enable ? 1 : 0;
+    return 0;
+}
+int pvc_set_lock_profiling( pvc_t pvc, int enable )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    enable = enable ? 1 : 0;
+    pvc->ring_buffer.mutex.profiling = enable;
+    pvc->mutex_producer.profiling = enable;
+    pvc->mutex_consumer.profiling = enable;
+    if ( pvc->pool )
+        pvc->pool->mutex.profiling = enable;
+    return 0;
+}
+static elem_pool_t * _pvc_pool_create( pvc_t pvc, size_t elem_size, size_t n_elems, int mem_flags )
+{
+    elem_pool_t * const pool = elem_pool_create( elem_size, n_elems, mem_flags );
+
+    if ( pool )
+        pool->mutex.profiling = pvc->ring_buffer.mutex.profiling;
+    return pool;
+}
+/* the old pool goes, none of its elements may still be held */
+static void _pvc_pool_replace( pvc_t pvc, elem_pool_t *pool )
+{
+    elem_pool_destroy( pvc->pool );
+    pvc->pool = pool;
+
+    if ( pvc->ring_buffer.handles ) {
+        pvc->ring_buffer.slab = pool->mem;
+        pvc->ring_buffer.slab_stride = pool->elem_size;
+        pvc->ring_buffer.slab_n = pool->n_elems;
+    }
+}
+int pvc_set_pool( pvc_t pvc, size_t elem_size, size_t n_elems )
+{
+    elem_pool_t * pool = NULL;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    // the old pool is freed, none of its elements may still be held
+    if ( pvc->pool && pvc->pool->n_free != pvc->pool->n_elems )
+        return -1;
+
+    // the ring of pvc_open_slab() indexes into the pool, keep one
+    if ( pvc->ring_buffer.handles &&
+         ( elem_size == 0 || n_elems == 0 || n_elems > UINT32_MAX ||
+           !ring_buffer_empty( &pvc->ring_buffer ) ) )
+        return -1;
+
+    if ( elem_size > 0 && n_elems > 0 ) {
+        pool = _pvc_pool_create( pvc, elem_size, n_elems, pvc->mem_flags );
+        if ( !pool )
+            return -1;
+    }
+
+    _pvc_pool_replace( pvc, pool );
+    return 0;
+}
+int pvc_set_byte_budget( pvc_t pvc, size_t bytes, int shed )
+{
+    ring_buffer_t * const rb = &pvc->ring_buffer;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    // value mode holds its bytes in the ring already, an unbounded one has no limit
+    if ( rb->slot_size || ( bytes && rb->queue ) || !ring_buffer_empty( rb ) )
+        return -1;
+
+    if ( bytes && !rb->elem_bytes ) {
+        rb->elem_bytes = calloc( rb->size, sizeof(size_t) );
+        if ( !rb->elem_bytes )
+            return -1;
+    } else if ( !bytes ) {
+        free( rb->elem_bytes );
+        rb->elem_bytes = NULL;
+    }
+    rb->byte_budget = bytes;
+    rb->bytes = 0;
+    pvc->shed = shed ? 1 : 0;
+    return 0;
+}
+int pvc_set_overflow( pvc_t pvc, pvc_overflow_t policy, unsigned int n )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    if ( policy > PVC_OVERFLOW_SAMPLE || ( policy == PVC_OVERFLOW_SAMPLE && n == 0 ) )
+        return -1;
+
+    // never full
+    if ( policy != PVC_OVERFLOW_BLOCK && pvc->ring_buffer.queue )
+        return -1;
+
+    pvc->overflow = policy;
+    pvc->ring_buffer.sample_n = n;
+    return 0;
+}
+int pvc_set_expiry( pvc_t pvc, int enable, unsigned long long default_ttl_ns )
+{
+    ring_buffer_t * const rb = &pvc->ring_buffer;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    if ( !ring_buffer_empty( rb ) || ( enable && rb->queue ) )
+        return -1;
+
+    if ( enable && !rb->deadlines ) {
+        rb->deadlines = calloc( rb->size, sizeof(unsigned long long) );
+        if ( !rb->deadlines )
+            return -1;
+    } else if ( !enable ) {
+        free( rb->deadlines );
+        rb->deadlines = NULL;
+    }
+    rb->default_ttl = enable ? default_ttl_ns : 0;
+    return 0;
+}
+int pvc_set_conflation( pvc_t pvc, pvc_cb_key_func_t func )
+{
+    ring_buffer_t * const rb = &pvc->ring_buffer;
+    size_t n;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    if ( func && rb->queue )
+        return -1;
+
+    if ( func && !rb->key_map ) {
+        if ( rb->size >= UINT32_MAX / 2 )
+            return -1;
+        // at most half full
+        for ( n = 2; n < 2 * rb->size; n <<= 1 )
+            ;
+        rb->key_map = calloc( n, sizeof(uint32_t) );
+        rb->keys = calloc( rb->size, sizeof(unsigned long long) );
+        if ( !rb->key_map || !rb->keys ) {
+            free( rb->key_map );
+            free( rb->keys );
+            rb->key_map = NULL;
+            rb->keys = NULL;
+            return -1;
+        }
+        rb->key_mask = n - 1;
+    } else if ( !func ) {
+        free( rb->key_map );
+        free( rb->keys );
+        rb->key_map = NULL;
+        rb->keys = NULL;
+    }
+    pvc->key = func;
+    return 0;
+}
+int pvc_set_discard( pvc_t pvc, pvc_cb_consume_func_t func )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    pvc->discard = func;
+    return 0;
+}
+int pvc_set_memory( pvc_t pvc, int flags )
+{
+    ring_buffer_t * const rb = &pvc->ring_buffer;
+    const size_t rb_bytes = RB_BYTES( rb );
+    char * mem = (char*)&pvc[1];
+    elem_pool_t * pool = NULL;
+    size_t mapped = 0;
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    // both are moved to the new memory, they must hold nothing
+    if ( ( flags && rb->queue ) || !ring_buffer_empty( rb ) ||
+         ( pvc->pool && pvc->pool->n_free != pvc->pool->n_elems ) )
+        return -1;
+
+    // all allocated before anything is replaced, for a failure to
+    // leave the PVC as it was
+    if ( flags ) {
+        mem = _pvc_mem_alloc( rb_bytes, flags, &mapped );
+        if ( !mem )
+            return -1;
+    }
+    if ( pvc->pool ) {
+        pool = _pvc_pool_create( pvc, pvc->pool->elem_size, pvc->pool->n_elems, flags );
+        if ( !pool ) {
+            if ( flags )
+                _pvc_mem_free( mem, mapped );
+            return -1;
+        }
+    }
+    if ( !flags )
+        memset( mem, 0, rb_bytes );
+
+    if ( pvc->rb_mem )
+        _pvc_mem_free( pvc->rb_mem, pvc->rb_mem_len );
+    pvc->rb_mem = flags ? mem : NULL;
+    pvc->rb_mem_len = mapped;
+    _pvc_ring_bind( rb, mem );
+
+    pvc->mem_flags = flags;
+    if ( pool )
+        _pvc_pool_replace( pvc, pool );
+    return 0;
+}
+void * pvc_pool_get( pvc_t pvc )
+{
+    elem_pool_t * const pool = pvc->pool;
+    pool_cache_t * cache;
+    void * elem = NULL;
+
+    assert( pool );
+
+    cache = _pvc_pool_cache( pool );
+
+    if ( !cache ) {
+        elem_pool_take( pool, &elem, 1 );
+        return elem;
+    }
+
+    if ( cache->n == 0 )
+        cache->n = elem_pool_take( pool, cache->elems, POOL_BATCH );
+    if ( cache->n > 0 )
+        elem = cache->elems[ --cache->n ];
+
+    return elem;
+}
+void pvc_pool_put( pvc_t pvc, void *elem )
+{
+    elem_pool_t * const pool = pvc->pool;
+    pool_cache_t * cache;
+
+    assert( pool && elem_pool_owns( pool, elem ) );
+
+    cache = _pvc_pool_cache( pool );
+
+    if ( !cache ) {
+        elem_pool_give( pool, &elem, 1 );
+        return;
+    }
+
+    // hand a batch back so that elements flow from consumers to producers
+    if ( cache->n == PVC_POOL_CACHE ) {
+        cache->n -= POOL_BATCH;
+        elem_pool_give( pool, cache->elems + cache->n, POOL_BATCH );
+    }
+    cache->elems[ cache->n++ ] = elem;
+}
+size_t pvc_get_stride( pvc_t pvc )
+{
+    return pvc->ring_buffer.slot_size ? pvc->ring_buffer.stride : 0;
+}
+size_t pvc_reserve( pvc_t pvc, void **slots, size_t n )
+{
+    return ring_buffer_reserve( &pvc->ring_buffer, slots, n );
+}
+void pvc_commit( pvc_t pvc, void *slots, size_t n )
+{
+    static const rb_meta_t meta;
+
+    ring_buffer_commit( &pvc->ring_buffer, slots, n, &meta );
+}
+size_t pvc_peek( pvc_t pvc, void **slots, size_t n )
+{
+    return ring_buffer_peek( &pvc->ring_buffer, slots, n );
+}
+void pvc_release( pvc_t pvc, void *slots, size_t n )
+{
+    ring_buffer_release( &pvc->ring_buffer, slots, n );
+}
+int pvc_set_stage_profiling( pvc_t pvc, int enable )
+{
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        return -1;
+
+    pvc->stage_profiling = enable ? 1 : 0;
+    pvc->ring_buffer.sampling = pvc->stage_profiling;
+    return 0;
+}
+int pvc_get_stats( pvc_t pvc, pvc_stats_t *stats )
+{
+    ring_buffer_t * const rb = &pvc->ring_buffer;
+    struct timespec now;
+
+    memset( stats, 0, sizeof(*stats) );
+
+    if ( pvc->started.tv_sec == 0 && pvc->started.tv_nsec == 0 )
+        return -1; // never started
+
+    if ( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) )
+        clock_gettime( CLOCK_MONOTONIC, &now );
+    else
+        now = pvc->stopped;
+
+    profiled_mutex_lock( &rb->mutex );
+    stats->capacity = rb->size - 1;
+    stats->elapsed = _pvc_elapsed_ns( &pvc->started, &now ) * 1.0E-9;
+    stats->occupancy = rb->occ_samples ? (double)rb->occ_sum / rb->occ_samples : 0.0;
+    stats->max_occupancy = rb->occ_max;
+    stats->bytes = rb->bytes;
+    stats->max_bytes = rb->max_bytes;
+    stats->n_shed = rb->n_shed;
+    stats->n_dropped = rb->n_dropped;
+    stats->n_evicted = rb->n_evicted;
+    stats->n_expired = rb->n_expired;
+    stats->n_conflated = rb->n_conflated;
+    profiled_mutex_unlock( &rb->mutex );
+
+    return 0;
+}
+int pvc_get_thread_stats( pvc_t pvc, pvc_thread_stats_t *stats, int max_stats )
+{
+    c_linklist_t * const l = pvc->thread_contexts;
+    c_linklist_t * const s = pvc->stopped_stats;
+    thread_context_t * ctx;
+    pvc_thread_stats_t * st;
+    c_link_t * p;
+    int n = 0;
+
+    for ( C_linklist_move_head_r( l, &p );
+          n < max_stats && (ctx = C_linklist_restore_r( l, &p )) != NULL;
+          C_linklist_move_next_r( l, &p ) ) {
+        if ( !( pvc->status & (PVC_STATUS_PRODUCER_RUNNING|PVC_STATUS_CONSUMER_RUNNING) ) )
+            break; // configured only, nothing to report
+        _pvc_get_thread_stats( ctx, &stats[n++] );
+    }
+    for ( C_linklist_move_head_r( s, &p );
+          n < max_stats && (st = C_linklist_restore_r( s, &p )) != NULL;
+          C_linklist_move_next_r( s, &p ) )
+        stats[n++] = *st;
+
+    return n;
+}
+/*
+ * Erlang C: probability that a job waits, with c servers offered a
+ * load of a erlangs (a < c).
+ */
+static double _pvc_erlang_c( unsigned int c, double a )
+{
+    double term = 1.0, sum = 1.0, top;
+    unsigned int k;
+
+    for ( k = 1; k < c; k++ ) {
+        term *= a / k;
+        sum += term;
+    }
+    top = term * a / c * c / ( c - a );
+    return top / ( sum + top );
+}
+/* least threads keeping utilization under target for rate x */
+static unsigned int _pvc_advise_threads( double x, double s )
+{
+    const double target = 0.8;
+    double c = ceil( x * s / target );
+
+    return c < 1.0 ? 1 : c > 65535.0 ? 65535 : (unsigned int)c;
+}
+int pvc_analyze( const pvc_t *pvcs, int n_pvc, pvc_stage_stats_t *stages, int max_stages )
+{
+    static const pvc_type_t order[] = {
+        PVC_PRODUCER, PVC_CHAINED_CONSUMER, PVC_CONSUMER,
+    };
+    pvc_thread_stats_t * ts = NULL;
+    int i, j, k, n_ts, n = 0, limit = -1, source = -1;
+    double x;
+
+    for ( i = 0; i < n_pvc; i++ ) {
+        const pvc_t pvc = pvcs[i];
+        const int max_ts = C_linklist_length( pvc->thread_contexts ) + C_linklist_length( pvc->stopped_stats );
+        pvc_stats_t ps;
+
+        if ( pvc_get_stats( pvc, &ps ) || ps.elapsed <= 0.0 )
+            continue;
+
+        ts = realloc( ts, ( max_ts + 1 ) * sizeof(*ts) );
+        assert( ts );
+        n_ts = pvc_get_thread_stats( pvc, ts, max_ts );
+
+        for ( j = 0; j < (int)(sizeof(order) / sizeof(order[0])) && n < max_stages; j++ ) {
+            pvc_stage_stats_t * const st = &stages[n];
+            unsigned long long service_ns = 0, service_cpu_ns = 0;
+
+            memset( st, 0, sizeof(*st) );
+            for ( k = 0; k < n_ts; k++ ) {
+                if ( ts[k].info.type != order[j] || ts[k].info.index == 0 )
+                    continue; // cleaner is not a stage
+                st->n_threads++;
+                st->n_calls += ts[k].info.n_round;
+                st->n_elems += ts[k].info.n_elem;
+                service_ns += ts[k].service_ns;
+                service_cpu_ns += ts[k].service_cpu_ns;
+            }
+            if ( st->n_threads == 0 )
+                continue;
+
+            st->pvc = pvc;
+            st->type = order[j];
+            st->service_time = st->n_calls ? service_ns * 1.0E-9 / st->n_calls : 0.0;
+            st->cpu_time = st->n_calls ? service_cpu_ns * 1.0E-9 / st->n_calls : 0.0;
+            st->throughput = st->n_elems / ps.elapsed;
+            st->utilization = service_ns * 1.0E-9 / ps.elapsed / st->n_threads;
+            st->occupancy = order[j] == PVC_PRODUCER ? -1.0 :
+                            ps.capacity ? ps.occupancy / ps.capacity : 0.0;
+            if ( source < 0 && order[j] == PVC_PRODUCER )
+                source = n;
+            n++;
+        }
+    }
+    free( ts );
+
+    if ( n == 0 )
+        return 0;
+
+    /*
+     * rings in front of the limiting stage fill up, rings behind it run
+     * dry: blame the stage draining the most downstream full ring, or
+     * the source when every ring stays mostly empty.
+     */
+    for ( i = 0; i < n; i++ ) {
+        if ( stages[i].occupancy >= 0.5 )
+            limit = i;
+    }
+    if ( limit < 0 )
+        limit = source >= 0 ? source : 0;
+    stages[limit].bottleneck = 1;
+
+    // size every stage for the rate the source can generate, producers
+    // take turns on their callback mutex so that is one per service time
+    if ( source >= 0 && stages[source].service_time > 0.0 )
+        x = 1.0 / stages[source].service_time;
+    else
+        x = stages[limit].throughput;
+
+    for ( i = 0; i < n; i++ ) {
+        pvc_stage_stats_t * const st = &stages[i];
+        const double a = x * st->service_time;
+
+        st->offered_load = a;
+        if ( i == source ) {
+            st->advised_threads = st->n_threads;
+        } else {
+            st->advised_threads = _pvc_advise_threads( x, st->service_time );
+        }
+        st->wait_time = ( x > 0.0 && a < st->advised_threads ) ?
+            _pvc_erlang_c( st->advised_threads, a ) / ( st->advised_threads / st->service_time - x ) : 0.0;
+    }
+
+    return n;
+}
+void pvc_print_analysis( const pvc_stage_stats_t *stages, int n_stages )
+{
+    int i, serialized = 0;
+
+    printf( "stage\tthreads\telems\tservice(us)\tcpu(us)\tput(/s)\tutil\tring\tadvise\twait(us)\n" );
+    for ( i = 0; i < n_stages; i++ ) {
+        const pvc_stage_stats_t * const st = &stages[i];
+        const char stype = st->type == PVC_PRODUCER ? 'P' :
+                           st->type == PVC_CONSUMER ? 'C' : 'X';
+
+        printf( "#%u.%c%s\t%u\t%llu\t%.2f\t\t%.2f\t%.0f\t%.2f\t",
+                st->pvc->id, stype, st->bottleneck ? "*" : "",
+                st->n_threads, st->n_elems, st->service_time * 1.0E6, st->cpu_time * 1.0E6,
+                st->throughput, st->utilization );
+        if ( st->occupancy < 0.0 )
+            printf( "-\t" );
+        else
+            printf( "%.0f%%\t", st->occupancy * 100.0 );
+        printf( "%u\t%.2f\n", st->advised_threads, st->wait_time * 1.0E6 );
+
+        if ( st->offered_load > 1.0 )
+            serialized = 1;
+    }
+    printf( "* limiting stage\n" );
+    if ( serialized )
+        printf( "note: callbacks of a stage are serialized by its callback mutex, "
+                "extra threads only overlap ring waits and may not reach the advised rate\n" );
+}
 int pvc_chain( pvc_t src, pvc_t dst, pvc_cb_chain_func_t func, int count )
 {
     while ( count-- > 0 ) {
@@ -589,6 +2630,7 @@ int pvc_chain( pvc_t src, pvc_t dst, pvc_cb_chain_func_t func, int count )
 
         assert( ctx );
 
+        ctx[0].pvc = src;
         ctx[0].ring_buffer = &src->ring_buffer;
         ctx[0].callback = func;
         ctx[0].callback_mutex = &src->mutex_consumer;
@@ -596,6 +2638,7 @@ int pvc_chain( pvc_t src, pvc_t dst, pvc_cb_chain_func_t func, int count )
         ctx[0].status = &src->status;
         ctx[0].info.type = PVC_CHAINED_CONSUMER;
 
+        ctx[1].pvc = dst;
         ctx[1].ring_buffer = &dst->ring_buffer;
         ctx[1].callback = NULL;
         ctx[1].callback_mutex = &dst->mutex_producer;
@@ -19,6 +19,8 @@
 #ifndef _PVC_H_
 #define _PVC_H_
 
+struct timespec;
+
 /**
  * @defgroup modpvc Producer vs. Consumer 
  * A simple interface to handle produce and consume logic, 
@@ -70,6 +72,38 @@
  */
 typedef struct pvc_s * pvc_t;
 
+/**
+ * elements each PVC thread may keep aside from the element pool,
+ * see pvc_set_pool()
+ */
+#define PVC_POOL_CACHE 32
+
+/**
+ * capacity of a PVC whose producers never wait, see pvc_open()
+ */
+#define PVC_UNBOUNDED 0
+
+/**
+ * backing of ring-buffers and element pools, see pvc_set_memory()
+ */
+typedef enum {
+    PVC_MEM_HUGETLB  = 0x01,  /// explicit huge pages, else as PVC_MEM_THP
+    PVC_MEM_THP      = 0x02,  /// transparent huge pages
+    PVC_MEM_LOCK     = 0x04,  /// mlock(), implies PVC_MEM_PREFAULT
+    PVC_MEM_PREFAULT = 0x08,  /// fault every page in at allocation
+} pvc_mem_flag_t;
+
+/**
+ * what becomes of an element finding no room in the ring, see
+ * pvc_set_overflow()
+ */
+typedef enum {
+    PVC_OVERFLOW_BLOCK = 0,     /// wait for consumers
+    PVC_OVERFLOW_DROP_NEWEST,   /// drop the new element
+    PVC_OVERFLOW_DROP_OLDEST,   /// evict the oldest element for it
+    PVC_OVERFLOW_SAMPLE,        /// drop but 1 in N, which evicts the oldest
+} pvc_overflow_t;
+
 /**
  * PVC thread type
  */
@@ -91,6 +125,74 @@ typedef struct {
     unsigned int n_round, n_elem;
 } pvc_info_t;
 
+/**
+ * hardware and software counters sampled per thread, see
+ * pvc_set_perf_counters()
+ */
+typedef enum {
+    PVC_PERF_CYCLES = 0,
+    PVC_PERF_INSTRUCTIONS,
+    PVC_PERF_CACHE_MISSES,
+    PVC_PERF_CONTEXT_SWITCHES,
+    PVC_PERF_NR,
+} pvc_perf_counter_t;
+
+/**
+ * PVC thread statistics type
+ *
+ * \c perf[i] is meaningful only when bit \c (1<<i) of
+ * \c perf_valid is set.
+ */
+typedef struct {
+    pvc_info_t info;
+    unsigned int perf_valid;
+    unsigned long long perf[ PVC_PERF_NR ];
+    unsigned long long service_ns;     /// wall time spent in callbacks
+    unsigned long long service_cpu_ns; /// thread cpu time spent in callbacks
+} pvc_thread_stats_t;
+
+/**
+ * PVC statistics type
+ *
+ * occupancy is sampled on every ring operation once
+ * pvc_set_stage_profiling() is enabled, but for an unbounded PVC.
+ */
+typedef struct {
+    size_t capacity;         /// 0 for PVC_UNBOUNDED
+    double elapsed;          /// seconds from pvc_start() to pvc_stop() or now
+    double occupancy;        /// mean elements held in the ring
+    size_t max_occupancy;
+    size_t bytes;            /// declared bytes held in the ring, see pvc_set_byte_budget()
+    size_t max_bytes;
+    unsigned long long n_shed; /// elements shed over the byte budget
+    unsigned long long n_dropped; /// new elements dropped, see pvc_set_overflow()
+    unsigned long long n_evicted; /// old elements evicted, see pvc_set_overflow()
+    unsigned long long n_expired; /// elements expired in the ring, see pvc_set_expiry()
+    unsigned long long n_conflated; /// elements replaced in place, see pvc_set_conflation()
+} pvc_stats_t;
+
+/**
+ * PVC stage analysis type, see pvc_analyze()
+ *
+ * a stage is the set of threads sharing one role on one PVC:
+ * its producers, its chained consumers or its consumers.
+ */
+typedef struct {
+    pvc_t pvc;
+    pvc_type_t type;         /// PVC_PRODUCER, PVC_CHAINED_CONSUMER or PVC_CONSUMER
+    unsigned int n_threads;
+    unsigned long long n_calls, n_elems;
+    double service_time;     /// mean wall seconds per callback
+    double cpu_time;         /// mean thread cpu seconds per callback
+    double throughput;       /// elements per second
+    double utilization;      /// busy fraction of each thread
+    double occupancy;        /// mean fill ratio of the input ring, -1 for producers
+    double offered_load;     /// erlangs at the advised rate
+    unsigned int advised_threads;
+    double wait_time;        /// predicted queueing delay with advised threads
+    int bottleneck;          /// non-zero for the limiting stage
+} pvc_stage_stats_t;
+
 /**
  * PVC producer callback type 
  *  
@@ -133,15 +235,64 @@ typedef int (*pvc_cb_consume_func_t)( void *arg, void *data );
  * @todo to handle the return value 
  */
 typedef int (*pvc_cb_chain_func_t)( void *arg, void **pdata );
+/**
+ * PVC key callback type, see pvc_set_conflation()
+ *
+ * gives the key of data block \c data, with the \c arg of the
+ * producer or chained up function handing it over. it is called
+ * outside of the callback lock.
+ */
+typedef unsigned long long (*pvc_cb_key_func_t)( void *arg, const void *data );
 
 /**
  * open a PVC, with ring-buffer has given elements.
+ *
+ * with PVC_UNBOUNDED, elements go through a lock-free queue growing by
+ * segments instead, and producers never wait: only consumers finding
+ * it empty do. byte budget, overflow policies, expiry, conflation and
+ * memory flags are refused for such a PVC, and value mode and slab
+ * PVCs cannot be unbounded.
  * 
- * @param max_elems the ring-buffer capabiliy
+ * @param max_elems the ring-buffer capabiliy, or PVC_UNBOUNDED
  * 
  * @return pvc_t the PVC just opened
  */
 pvc_t pvc_open( size_t max_elems );
+/**
+ * open a PVC in value mode, with ring-buffer holding the data
+ * themselves instead of pointers to them.
+ *
+ * in value mode, callbacks handle data blocks of \c slot_size
+ * bytes which live in a ring slot or a buffer owned by the calling
+ * thread: a producer finds \c *pdata pointing to it and fills it
+ * in, and sets \c *pdata to NULL or returns non-zero when nothing is
+ * produced; a consumer, a chained up function and the cleanup
+ * function of pvc_stop() get it filled in, and must not free it. no
+ * allocation happens per data block.
+ *
+ * @param max_elems the ring-buffer capabiliy
+ * @param slot_size size of each data block in bytes
+ *
+ * @return pvc_t the PVC just opened
+ */
+pvc_t pvc_open_slots( size_t max_elems, size_t slot_size );
+/**
+ * open a PVC with its own element pool, see pvc_set_pool(), and
+ * ring-buffer holding 32-bit indexes into the pool instead of
+ * pointers.
+ *
+ * callbacks handle pointers as with pvc_open(), but every data block
+ * put into the PVC, by producers or chained up functions, must come
+ * from pvc_pool_get() of this PVC. the pool may be replaced while the
+ * PVC is stopped and empty, but not dropped.
+ *
+ * @param max_elems the ring-buffer capabiliy
+ * @param elem_size size of each element in bytes
+ * @param n_elems count of elements, up to UINT32_MAX
+ *
+ * @return pvc_t the PVC just opened, NULL on failure
+ */
+pvc_t pvc_open_slab( size_t max_elems, size_t elem_size, size_t n_elems );
 /**
  * close a PVC.
  * 
@@ -203,6 +354,352 @@ int pvc_add_consumer( pvc_t pvc, pvc_cb_consume_func_t func, int count );
  */
 int pvc_chain( pvc_t src, pvc_t dst, pvc_cb_chain_func_t func, int count );
 
+/**
+ * attach a pool of fixed-size elements to a PVC, replacing any
+ * previous one.
+ *
+ * elements are taken with pvc_pool_get() and given back with
+ * pvc_pool_put(), typically by producers and by consumers or the
+ * cleanup function of pvc_stop() respectively. every PVC thread keeps
+ * up to PVC_POOL_CACHE elements aside, and moves them from and to the
+ * pool by batches, so \c n_elems should cover the ring, the elements
+ * held by callbacks and PVC_POOL_CACHE per thread using the pool.
+ *
+ * @param pvc the PVC to operate, must not be running, with all the
+ *            elements of its current pool given back
+ * @param elem_size size of each element in bytes
+ * @param n_elems count of elements, 0 to drop the pool
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_pool( pvc_t pvc, size_t elem_size, size_t n_elems );
+/**
+ * take an element from the pool of a PVC
+ *
+ * @param pvc the PVC owning the pool
+ *
+ * @return void* the element, NULL when the pool is exhausted
+ */
+void * pvc_pool_get( pvc_t pvc );
+/**
+ * give an element back to the pool of a PVC
+ *
+ * @param pvc the PVC owning the pool
+ * @param elem an element from pvc_pool_get() of the same PVC
+ */
+void pvc_pool_put( pvc_t pvc, void *elem );
+
+/**
+ * bound the bytes held in the ring of a PVC, on top of its count of
+ * elements.
+ *
+ * producers and chained up functions declare the size of the data
+ * block they hand over with pvc_declare_size(), blocks not declared
+ * count 0 bytes, and chained up blocks keep their size unless
+ * declared again. a block which would take the ring beyond \c bytes
+ * waits for consumers, or is shed when \c shed is set: it is handed to
+ * the function of pvc_set_discard() instead, if there is one. a block
+ * larger than the budget still goes into an empty ring.
+ *
+ * @param pvc the PVC to operate, must not be running, nor in value
+ *            mode, with its ring empty
+ * @param bytes the budget in bytes, 0 for none
+ * @param shed non-zero to shed rather than wait
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_byte_budget( pvc_t pvc, size_t bytes, int shed );
+/**
+ * declare the size of the data block being handed over, from a
+ * producer or a chained up function.
+ *
+ * @param bytes size of the data block, as counted by
+ *              pvc_set_byte_budget()
+ */
+void pvc_declare_size( size_t bytes );
+/**
+ * choose what becomes of a data block finding no room in the ring
+ * of a PVC, either full or over its byte budget.
+ *
+ * dropped and evicted blocks go to the function of
+ * pvc_set_discard(); without one, a PVC holding pointers blocks
+ * whatever the policy. consumers hold on to the oldest block while
+ * handling it, in which case a block to evict it waits. under
+ * overload, blocks wait at most for one callback of a consumer
+ * instead of for the whole ring to drain.
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param policy the overflow policy
+ * @param n with PVC_OVERFLOW_SAMPLE, keep 1 in \c n of the blocks
+ *          finding no room
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_overflow( pvc_t pvc, pvc_overflow_t policy, unsigned int n );
+/**
+ * let data blocks expire in the ring of a PVC.
+ *
+ * a block carries the deadline declared by pvc_declare_ttl() or
+ * pvc_declare_deadline() from its producer or chained up function,
+ * else one \c default_ttl_ns away from entering the ring, else none;
+ * chained up blocks keep their deadline unless declared again.
+ * consumers never get a block past its deadline: it is handed to the
+ * function of pvc_set_discard() instead, or in value mode, released.
+ * without a discard function, a PVC holding pointers never expires
+ * blocks. deadlines are checked at the head of the ring only, when
+ * consumers take blocks.
+ *
+ * @param pvc the PVC to operate, must not be running, with its ring
+ *            empty
+ * @param enable non-zero to track deadlines, 0 to stop
+ * @param default_ttl_ns time to live of blocks without a declared
+ *                       deadline, 0 for none
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_expiry( pvc_t pvc, int enable, unsigned long long default_ttl_ns );
+/**
+ * declare the time to live of the data block being handed over, from
+ * a producer or a chained up function, see pvc_set_expiry().
+ *
+ * @param ttl_ns nanoseconds from now, 0 for no deadline
+ */
+void pvc_declare_ttl( unsigned long long ttl_ns );
+/**
+ * same as pvc_declare_ttl(), with a deadline on CLOCK_MONOTONIC.
+ *
+ * @param deadline the deadline, NULL for none
+ */
+void pvc_declare_deadline( const struct timespec *deadline );
+/**
+ * conflate data blocks by key in the ring of a PVC, for consumers to
+ * see only the latest block of each key.
+ *
+ * a block whose key is the one of a block still waiting in the ring
+ * replaces it in place, keeping its position, and whatever the room
+ * left; the replaced block goes to the function of pvc_set_discard(),
+ * or in value mode is simply overwritten. without a discard function,
+ * a PVC holding pointers never conflates. blocks already handed to
+ * consumers, or reserved with pvc_reserve(), are never replaced.
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param func the key function, NULL for plain FIFO
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_conflation( pvc_t pvc, pvc_cb_key_func_t func );
+/**
+ * set the function to give data blocks a PVC gives up on, e.g. when
+ * shedding over its byte budget. it is called from the thread giving
+ * the block up, with the \c arg of that thread, and should free the
+ * block like a consumer would.
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param func the discard function, NULL for none
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_discard( pvc_t pvc, pvc_cb_consume_func_t func );
+
+/**
+ * choose the memory backing the ring-buffer and the element pool of
+ * a PVC, which are re-allocated accordingly, as is any pool attached
+ * later.
+ *
+ * huge pages cut TLB misses on large rings and pools. when none are
+ * reserved for PVC_MEM_HUGETLB the memory is aligned and advised for
+ * transparent ones, and when those are disabled too regular pages are
+ * used. with PVC_MEM_PREFAULT or PVC_MEM_LOCK no page fault happens
+ * on them once the PVC is started; an mlock() failure, e.g. beyond
+ * RLIMIT_MEMLOCK, is logged and leaves the memory unlocked.
+ *
+ * @param pvc the PVC to operate, must not be running, with its ring
+ *            empty and all pool elements given back
+ * @param flags bitwise or of pvc_mem_flag_t, 0 for the heap
+ *
+ * @return int 0 on success, -1 on failure, the ring and pool left
+ *         as they were
+ */
+int pvc_set_memory( pvc_t pvc, int flags );
+
+/**
+ * get the distance in bytes between two slots of a PVC opened by
+ * pvc_open_slots(), i.e. \c slot_size rounded up to pointer alignment.
+ *
+ * @param pvc the PVC to operate
+ *
+ * @return size_t the slot stride, 0 for a PVC holding pointers
+ */
+size_t pvc_get_stride( pvc_t pvc );
+/**
+ * reserve free slots of a PVC opened by pvc_open_slots(), to be
+ * written in place and published with pvc_commit().
+ *
+ * the slots reserved follow each other in memory, pvc_get_stride()
+ * bytes apart, so fewer than \c n may be given at the end of the ring.
+ * slots committed by others after this reservation reach consumers
+ * only once it is committed, keep it short.
+ *
+ * @param pvc the PVC to operate
+ * @param slots where to store the first slot reserved
+ * @param n count of slots wanted
+ *
+ * @return size_t count of slots reserved, 0 when the PVC stayed full
+ *         for a while or is being stopped, the caller should retry
+ */
+size_t pvc_reserve( pvc_t pvc, void **slots, size_t n );
+/**
+ * publish slots reserved with pvc_reserve() to consumers
+ *
+ * @param pvc the PVC to operate
+ * @param slots the first slot of the reservation
+ * @param n count of slots written, the rest of the reservation is
+ *          given up
+ */
+void pvc_commit( pvc_t pvc, void *slots, size_t n );
+/**
+ * take published slots of a PVC opened by pvc_open_slots(), to be
+ * read in place and given back with pvc_release().
+ *
+ * the slots taken follow each other in memory, pvc_get_stride() bytes
+ * apart, so fewer than \c n may be given at the end of the ring. they
+ * are not available to producers until released.
+ *
+ * @param pvc the PVC to operate
+ * @param slots where to store the first slot taken
+ * @param n count of slots wanted
+ *
+ * @return size_t count of slots taken, 0 when the PVC stayed empty for
+ *         a while or is being stopped, the caller should retry
+ */
+size_t pvc_peek( pvc_t pvc, void **slots, size_t n );
+/**
+ * give slots taken with pvc_peek() back to producers, either all at
+ * once or by parts in any order
+ *
+ * @param pvc the PVC to operate
+ * @param slots the first slot to give back
+ * @param n count of slots to give back
+ */
+void pvc_release( pvc_t pvc, void *slots, size_t n );
+
+/**
+ * set the stack and guard sizes of the threads of a PVC, instead of
+ * the defaults of pthread_create() (8 MB stacks on most systems).
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param type PVC_PRODUCER, PVC_CONSUMER (also the cleaner of
+ *             pvc_stop()), PVC_CHAINED_CONSUMER (the threads of
+ *             pvc_chain() from this PVC), or _PVC_UNKNOWN_TYPE for all
+ * @param stack_size stack size in bytes, at least PTHREAD_STACK_MIN,
+ *                   0 for the default
+ * @param guard_size guard size in bytes, 0 for the default
+ *
+ * @return int 0 on success, -1 when the PVC is running
+ */
+int pvc_set_thread_attr( pvc_t pvc, pvc_type_t type, size_t stack_size, size_t guard_size );
+/**
+ * name the threads of a PVC after a pattern, where \c %i is the PVC
+ * id, \c %r the role (P for producers, C for consumers, chained up
+ * jobs and the cleaner), and \c %n the index of the thread in its
+ * role. names are cut to 15 characters. the default pattern is
+ * "pvc%i-%r%n", e.g. "pvc3-C7".
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param pattern the pattern, up to 31 characters, NULL to leave
+ *                threads unnamed
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int pvc_set_thread_name( pvc_t pvc, const char *pattern );
+
+/**
+ * count cycles, instructions, cache misses and context switches of
+ * every PVC thread, from its start to its exit.
+ *
+ * counters the host does not allow (no PMU, perf_event_paranoid,
+ * seccomp...) are silently left out; context switches fall back to
+ * getrusage().
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param enable non-zero to enable
+ *
+ * @return int 0 on success, -1 when the PVC is running
+ */
+int pvc_set_perf_counters( pvc_t pvc, int enable );
+/**
+ * account acquisitions, contended acquisitions, wait and hold time of
+ * the ring-buffer mutex and the producer and consumer callback
+ * mutexes of a PVC. a report ranked by total wait time is printed by
+ * pvc_stop().
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param enable non-zero to enable
+ *
+ * @return int 0 on success, -1 when the PVC is running
+ */
+int pvc_set_lock_profiling( pvc_t pvc, int enable );
+/**
+ * time every callback on wall and thread cpu clocks, and sample ring
+ * occupancy on every ring operation, for pvc_analyze().
+ *
+ * @param pvc the PVC to operate, must not be running
+ * @param enable non-zero to enable
+ *
+ * @return int 0 on success, -1 when the PVC is running
+ */
+int pvc_set_stage_profiling( pvc_t pvc, int enable );
+/**
+ * collect statistics of a PVC, live or of its last run.
+ *
+ * @param pvc the PVC to query
+ * @param stats to fill in
+ *
+ * @return int 0 on success, -1 when the PVC never started
+ */
+int pvc_get_stats( pvc_t pvc, pvc_stats_t *stats );
+/**
+ * find the limiting stage of a pipeline and advise thread counts.
+ *
+ * stages are listed in pipeline order of \c pvcs, which should be
+ * given upstream first. every stage is sized so that it can take the
+ * rate its source could generate at 80% utilization (M/M/c), and the
+ * limiting stage is the one draining the most downstream ring which
+ * is more than half full on average.
+ *
+ * needs pvc_set_stage_profiling() on every PVC of the pipeline.
+ *
+ * @param pvcs the PVC of the pipeline
+ * @param n_pvc count of \c pvcs
+ * @param stages array to fill in
+ * @param max_stages capacity of \c stages
+ *
+ * @return int number of stages filled
+ */
+int pvc_analyze( const pvc_t *pvcs, int n_pvc, pvc_stage_stats_t *stages, int max_stages );
+/**
+ * print the result of pvc_analyze() to stdout
+ *
+ * @param stages as filled by pvc_analyze()
+ * @param n_stages count of \c stages
+ */
+void pvc_print_analysis( const pvc_stage_stats_t *stages, int n_stages );
+/**
+ * collect per thread statistics of a PVC.
+ *
+ * while running, threads report their live values. after
+ * pvc_stop(), the final values of the last run are kept until
+ * the next pvc_start(). chained threads are reported by their
+ * source PVC with type PVC_CHAINED_CONSUMER.
+ *
+ * @param pvc the PVC to query
+ * @param stats array to fill in
+ * @param max_stats capacity of \c stats
+ *
+ * @return int number of entries filled
+ */
+int pvc_get_thread_stats( pvc_t pvc, pvc_thread_stats_t *stats, int max_stats );
+
 /**
  * to query the active PVC job infomation in a callback
  * 
@@ -0,0 +1,362 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  testcycle.c
+ *
+ *    Description:  Start/stop cycle benchmark of PvC module
+ *
+ *        Version:  1.0
+ *        Created:  2026/10/18 22时40分12秒
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Levi G (yxguo), yxguo@wisvideo.com.cn
+ *   Organization:  WisVideo
+ *
+ * =====================================================================================
+ */
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "pvc.h"
+
+// size declared per element against the byte budget
+#define ELEM_BYTES 100
+
+enum {
+    PAYLOAD_HEAP = 0,   /// malloc() per element
+    PAYLOAD_POOL,       /// pvc_set_pool()
+    PAYLOAD_SLOT,       /// pvc_open_slots()
+    PAYLOAD_SLAB,       /// pvc_open_slab()
+    PAYLOAD_UNBOUNDED,  /// malloc() per element, pvc_open( PVC_UNBOUNDED )
+    PAYLOAD_EXPIRY,     /// pvc_open_slots(), pvc_set_expiry()
+    PAYLOAD_HEAP_EXPIRY, /// malloc() per element, pvc_set_expiry()
+    PAYLOAD_DROP_NEWEST, /// malloc() per element, PVC_OVERFLOW_DROP_NEWEST
+    PAYLOAD_DROP_OLDEST, /// malloc() per element, PVC_OVERFLOW_DROP_OLDEST
+    PAYLOAD_SAMPLE,     /// malloc() per element, PVC_OVERFLOW_SAMPLE
+    PAYLOAD_CONFLATE,   /// malloc() per element, pvc_set_conflation()
+    PAYLOAD_BUDGET,     /// malloc() per element, pvc_set_byte_budget() blocking
+    PAYLOAD_SHED,       /// malloc() per element, pvc_set_byte_budget() shedding
+    PAYLOAD_NR,
+};
+
+typedef struct {
+    pvc_t pvc;
+    int payload;
+    int acc;
+    int produced;
+    int consumed;
+    int discarded;
+} cycle_context_t;
+
+typedef struct {
+    const char *name;
+    double *samples;
+    int count;
+} distribution_t;
+
+static int produce_data( void *ctx, void **pdata )
+{
+    cycle_context_t * const c = ctx;
+    int *value;
+
+    switch ( c->payload ) {
+    case PAYLOAD_POOL:
+    case PAYLOAD_SLAB:
+        value = pvc_pool_get( c->pvc );
+        break;
+    case PAYLOAD_SLOT:
+    case PAYLOAD_EXPIRY:
+        value = *pdata;
+        break;
+    default:
+        value = malloc( sizeof(int) );
+    }
+    // expire some right away, and the others if not consumed soon
+    if ( ( c->payload == PAYLOAD_EXPIRY || c->payload == PAYLOAD_HEAP_EXPIRY ) &&
+         c->acc % 3 == 0 )
+        pvc_declare_ttl( 1000 );
+    else if ( c->payload == PAYLOAD_BUDGET || c->payload == PAYLOAD_SHED )
+        pvc_declare_size( ELEM_BYTES );
+    if ( !value ) {
+        *pdata = NULL;
+        return -1;
+    }
+    *value = ++c->acc;
+    *pdata = value;
+    __sync_add_and_fetch( &c->produced, 1 );
+    return 0;
+}
+static void release_data( cycle_context_t *c, void *data )
+{
+    switch ( c->payload ) {
+    case PAYLOAD_POOL:
+    case PAYLOAD_SLAB:
+        pvc_pool_put( c->pvc, data );
+        break;
+    case PAYLOAD_SLOT:
+    case PAYLOAD_EXPIRY:
+        break;
+    default:
+        free( data );
+    }
+}
+static int consume_data( void *ctx, void *data )
+{
+    cycle_context_t * const c = ctx;
+
+    release_data( c, data );
+    __sync_add_and_fetch( &c->consumed, 1 );
+    return 0;
+}
+static int discard_data( void *ctx, void *data )
+{
+    cycle_context_t * const c = ctx;
+
+    release_data( c, data );
+    __sync_add_and_fetch( &c->discarded, 1 );
+    return 0;
+}
+
+/* a pool is only replaced once all its elements are back, 1 if not */
+static int set_pool( pvc_t pvc, size_t n_elems )
+{
+    void * held;
+    int wrong = 0;
+
+    pvc_set_pool( pvc, sizeof(int), n_elems );
+    held = pvc_pool_get( pvc );
+    if ( !held || pvc_set_pool( pvc, sizeof(int), n_elems ) == 0 )
+        wrong = 1;
+    else
+        pvc_pool_put( pvc, held );
+    if ( pvc_set_pool( pvc, sizeof(int), n_elems ) )
+        wrong = 1;
+    return wrong;
+}
+/* threads reporting no context switch count, though it is always kept */
+static int count_unswitched( pvc_t pvc )
+{
+    pvc_thread_stats_t stats[ 64 ];
+    const int n = pvc_get_thread_stats( pvc, stats, 64 );
+    int i, k = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( !( stats[i].perf_valid & (1u << PVC_PERF_CONTEXT_SWITCHES) ) )
+            k++;
+    }
+    return k;
+}
+static unsigned long long key_data( void *ctx, const void *data )
+{
+    return *(const int *)data % 8;
+}
+
+static double now_us( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1.0E6 + ts.tv_nsec * 1.0E-3;
+}
+
+static int compare_double( const void *a, const void *b )
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+static void show_distribution( distribution_t *d )
+{
+    double sum = 0.0;
+    int i;
+
+    if ( d->count == 0 )
+        return;
+
+    qsort( d->samples, d->count, sizeof(double), compare_double );
+    for ( i = 0; i < d->count; i++ )
+        sum += d->samples[i];
+
+#define PCT(p) d->samples[ (int)( (d->count - 1) * (p) / 100.0 + 0.5 ) ]
+    printf( "%-10s n=%d mean=%.1f min=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f (us)\n",
+            d->name, d->count, sum / d->count, d->samples[0],
+            PCT(50), PCT(90), PCT(99), d->samples[ d->count - 1 ] );
+#undef PCT
+}
+
+int main( int argc, char *argv[] )
+{
+    static const size_t backlogs[] = { 1, 4, 64, 1024 };
+    const int n_backlogs = sizeof(backlogs) / sizeof(backlogs[0]);
+    distribution_t start = { "start" }, stop = { "stop/drain" };
+    int n_cycles, max_producer, max_consumer;
+    int i, fd_stdout, fd_null, leaked = 0, leaky_cycles = 0;
+    long long n_elems = 0, n_expired = 0, n_heap_expired = 0, n_discarded = 0, n_overflown = 0, n_conflated = 0, n_shed = 0;
+    int over_budget = 0, pool_replaced = 0, unswitched = 0;
+    int n_runs[ PAYLOAD_NR ] = { 0 };
+
+    if ( argc > 1 && !strcmp( argv[ argc - 1 ], "-h" ) ) {
+        printf( "Usage: %s [CYCLES] [MAXPROD] [MAXCONS]\n", argv[0] );
+        exit( 0 );
+    }
+
+    n_cycles = argc > 1 ? atoi( argv[1] ) : 2000;
+    max_producer = argc > 2 ? atoi( argv[2] ) : 8;
+    max_consumer = argc > 3 ? atoi( argv[3] ) : 8;
+
+    assert( n_cycles > 0 );
+    assert( max_producer > 0 );
+    assert( max_consumer > 0 );
+
+    start.samples = calloc( n_cycles, sizeof(double) );
+    stop.samples = calloc( n_cycles, sizeof(double) );
+    assert( start.samples && stop.samples );
+
+    printf( "cycles=%d, producers=1..%d, consumers=1..%d, backlogs=%zd..%zd, "
+            "payloads=heap/pool/slot/slab/unbounded/expiry/heap-expiry/drop-newest/drop-oldest/sample/conflate/budget/shed\n",
+            n_cycles, max_producer, max_consumer, backlogs[0], backlogs[ n_backlogs - 1 ] );
+
+    // the engine logs every thread start and stop, keep it out of the timing
+    fflush( stdout );
+    fd_stdout = dup( STDOUT_FILENO );
+    fd_null = open( "/dev/null", O_WRONLY );
+    assert( fd_stdout >= 0 && fd_null >= 0 );
+    dup2( fd_null, STDOUT_FILENO );
+
+    for ( i = 0; i < n_cycles; i++ ) {
+        const int n_producer = 1 + i % max_producer;
+        const int n_consumer = 1 + ( i / max_producer ) % max_consumer;
+        // each series goes through every thread count with one payload,
+        // whatever PAYLOAD_NR has in common with them
+        const int series = i / max_producer / max_consumer;
+        const size_t n_max_elems = backlogs[ series % n_backlogs ];
+        cycle_context_t ctx = { NULL, series % PAYLOAD_NR };
+        const size_t n_pool_elems = n_max_elems + ( n_producer + n_consumer + 1 ) * ( PVC_POOL_CACHE + 1 );
+        // the budget binds before the element count
+        const size_t budget = ( n_max_elems + 1 ) / 2 * ELEM_BYTES;
+        double t0, t1, deadline;
+        int released;
+        pvc_stats_t stats;
+        pvc_thread_stats_t live[ 64 ];
+        pvc_t pvc;
+
+        if ( ctx.payload == PAYLOAD_SLOT || ctx.payload == PAYLOAD_EXPIRY )
+            pvc = pvc_open_slots( n_max_elems, sizeof(int) );
+        else if ( ctx.payload == PAYLOAD_SLAB )
+            pvc = pvc_open_slab( n_max_elems, sizeof(int), n_pool_elems );
+        else if ( ctx.payload == PAYLOAD_UNBOUNDED )
+            pvc = pvc_open( PVC_UNBOUNDED );
+        else
+            pvc = pvc_open( n_max_elems );
+        if ( ctx.payload == PAYLOAD_POOL )
+            pool_replaced += set_pool( pvc, n_pool_elems );
+        else if ( ctx.payload == PAYLOAD_EXPIRY || ctx.payload == PAYLOAD_HEAP_EXPIRY )
+            pvc_set_expiry( pvc, 1, 200000 );
+        else if ( ctx.payload == PAYLOAD_DROP_NEWEST )
+            pvc_set_overflow( pvc, PVC_OVERFLOW_DROP_NEWEST, 0 );
+        else if ( ctx.payload == PAYLOAD_DROP_OLDEST )
+            pvc_set_overflow( pvc, PVC_OVERFLOW_DROP_OLDEST, 0 );
+        else if ( ctx.payload == PAYLOAD_SAMPLE )
+            pvc_set_overflow( pvc, PVC_OVERFLOW_SAMPLE, 4 );
+        else if ( ctx.payload == PAYLOAD_CONFLATE )
+            pvc_set_conflation( pvc, key_data );
+        else if ( ctx.payload == PAYLOAD_BUDGET || ctx.payload == PAYLOAD_SHED )
+            pvc_set_byte_budget( pvc, budget, ctx.payload == PAYLOAD_SHED );
+        pvc_set_discard( pvc, discard_data );
+        pvc_set_perf_counters( pvc, i % 4 == 1 );
+        ctx.pvc = pvc;
+
+        pvc_add_producer( pvc, produce_data, n_producer );
+        pvc_add_consumer( pvc, consume_data, n_consumer );
+
+        t0 = now_us();
+        pvc_start( pvc, &ctx );
+        t1 = now_us();
+        start.samples[ start.count++ ] = t1 - t0;
+
+        // let some data flow before stopping, at most 10ms, sampling
+        // the counters of threads that may be leaving meanwhile
+        for ( deadline = t1 + 10000.0;
+              ctx.consumed < (int)n_max_elems && now_us() < deadline; ) {
+            if ( i % 4 == 1 )
+                pvc_get_thread_stats( pvc, live, 64 );
+            usleep( 10 );
+        }
+
+        t0 = now_us();
+        pvc_stop( pvc, consume_data, &ctx );
+        t1 = now_us();
+        stop.samples[ stop.count++ ] = t1 - t0;
+
+        // elements expired in value mode are simply released, pointers
+        // go to discard_data() and are counted there
+        pvc_get_stats( pvc, &stats );
+        if ( i % 4 == 1 )
+            unswitched += count_unswitched( pvc );
+        pvc_close( pvc );
+        released = ctx.payload == PAYLOAD_EXPIRY ? (int)stats.n_expired : 0;
+
+        n_runs[ ctx.payload ]++;
+        n_elems += ctx.consumed;
+        n_expired += stats.n_expired;
+        if ( ctx.payload == PAYLOAD_HEAP_EXPIRY )
+            n_heap_expired += stats.n_expired;
+        n_discarded += ctx.discarded;
+        n_overflown += stats.n_dropped + stats.n_evicted;
+        n_conflated += stats.n_conflated;
+        n_shed += stats.n_shed;
+        if ( ( ctx.payload == PAYLOAD_BUDGET || ctx.payload == PAYLOAD_SHED ) &&
+             stats.max_bytes > budget )
+            over_budget++;
+        if ( ctx.produced != ctx.consumed + ctx.discarded + released ) {
+            leaked += ctx.produced - ctx.consumed - ctx.discarded - released;
+            leaky_cycles++;
+        }
+    }
+
+    fflush( stdout );
+    dup2( fd_stdout, STDOUT_FILENO );
+    close( fd_stdout );
+    close( fd_null );
+
+    show_distribution( &start );
+    show_distribution( &stop );
+    printf( "elements: %lld passed, %lld expired, %lld discarded (%lld overflown, %lld conflated, %lld shed), %d leaked in %d cycles\n",
+            n_elems, n_expired, n_discarded, n_overflown, n_conflated, n_shed, leaked, leaky_cycles );
+
+    free( start.samples );
+    free( stop.samples );
+
+    // producers outrun consumers often enough for keys to collide
+    if ( n_runs[ PAYLOAD_CONFLATE ] && n_conflated == 0 ) {
+        printf( "no element conflated\n" );
+        return -1;
+    }
+    if ( n_runs[ PAYLOAD_SHED ] && n_shed == 0 ) {
+        printf( "no element shed\n" );
+        return -1;
+    }
+    // some are declared to live 1us only
+    if ( n_runs[ PAYLOAD_HEAP_EXPIRY ] && n_heap_expired == 0 ) {
+        printf( "no pointer expired\n" );
+        return -1;
+    }
+    if ( pool_replaced ) {
+        printf( "pool replaced while in use, or not once back, in %d cycles\n", pool_replaced );
+        return -1;
+    }
+    if ( unswitched ) {
+        printf( "context switches not counted for %d threads\n", unswitched );
+        return -1;
+    }
+    if ( over_budget ) {
+        printf( "byte budget exceeded in %d cycles\n", over_budget );
+        return -1;
+    }
+
+    return leaked ? -1 : 0;
+}
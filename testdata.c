@@ -0,0 +1,1423 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  testdata.c
+ *
+ *    Description:  Randomized tests of the data structures against reference models
+ *
+ *        Version:  1.0
+ *        Created:  2026/10/18 23时52分07秒
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Levi G (yxguo), yxguo@wisvideo.com.cn
+ *   Organization:  WisVideo
+ *
+ * =====================================================================================
+ */
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "data.h"
+
+#define CHECK(e) do {                                                   \
+        if ( !(e) ) {                                                   \
+            printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #e ); \
+            return -1;                                                  \
+        }                                                               \
+    } while ( 0 )
+
+static unsigned long long rng_state;
+
+static unsigned int rng_r( unsigned long long *state )
+{
+    // xorshift64*, reproducible from the seed printed
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ( *state * 0x2545F4914F6CDD1DULL ) >> 32;
+}
+static unsigned int rng( void )
+{
+    return rng_r( &rng_state );
+}
+
+/*
+ * hash table
+ */
+
+#define HT_KEYS 5000
+
+static int ht_destroyed;
+
+static void ht_destructor( void *data )
+{
+    ht_destroyed++;
+}
+// all keys of the same first character collide
+static uint_t ht_weak_hash( const char *s, uint_t modulo )
+{
+    return (unsigned char)s[0] % modulo;
+}
+
+static int ht_check_all( c_hashtable_t *h, const uintptr_t *ref, int n_keys, size_t size )
+{
+    char key[16], **keys;
+    size_t len, i;
+    int k;
+
+    CHECK( C_hashtable_size( h ) == size );
+    for ( k = 0; k < n_keys; k++ ) {
+        sprintf( key, "k%d", k );
+        CHECK( (uintptr_t)C_hashtable_restore( h, key ) == ref[k] );
+    }
+
+    keys = C_hashtable_keys( h, &len );
+    CHECK( keys && len == size );
+    for ( i = 0; i < len; i++ ) {
+        CHECK( keys[i] && keys[i][0] == 'k' );
+        k = atoi( keys[i] + 1 );
+        CHECK( k >= 0 && k < n_keys && ref[k] );
+    }
+    CHECK( keys[len] == NULL );
+    C_free( keys );
+    return 0;
+}
+/* ops are biased to stores, then to deletes, for the table to grow with
+ * tombstones left and migrations in progress */
+static int ht_run( c_hashtable_t *h, uintptr_t *ref, int n_keys, int n_ops,
+                   size_t *size, int *n_replaced, int *n_deleted )
+{
+    char key[16];
+    int i, k, op, bias;
+
+    for ( i = 0; i < n_ops; i++ ) {
+        bias = i < n_ops / 2 ? 6 : 3;
+        k = rng() % n_keys;
+        op = rng() % 10;
+        sprintf( key, "k%d", k );
+        if ( op < bias ) {
+            const uintptr_t v = ( (uintptr_t)rng() << 1 ) | 1;
+
+            CHECK( C_hashtable_store( h, key, (void *)v ) );
+            if ( ref[k] )
+                ( *n_replaced )++;
+            else
+                ( *size )++;
+            ref[k] = v;
+        } else if ( op < 9 ) {
+            CHECK( C_hashtable_delete( h, key ) == ( ref[k] != 0 ) );
+            if ( ref[k] ) {
+                ( *size )--;
+                ( *n_deleted )++;
+            }
+            ref[k] = 0;
+        } else {
+            CHECK( (uintptr_t)C_hashtable_restore( h, key ) == ref[k] );
+        }
+        CHECK( C_hashtable_size( h ) == *size );
+        if ( i % 20011 == 0 && ht_check_all( h, ref, n_keys, *size ) )
+            return -1;
+    }
+    return ht_check_all( h, ref, n_keys, *size );
+}
+static int test_hashtable( void )
+{
+    static uintptr_t ref[ HT_KEYS ];
+    int n_replaced = 0, n_deleted = 0;
+    size_t size = 0;
+    c_hashtable_t *h;
+    uint_t buckets;
+
+    // from the smallest table, across many resizes
+    h = C_hashtable_create( 0 );
+    CHECK( h && C_hashtable_buckets( h ) == C_HASHTABLE_MIN_BUCKETS );
+    C_hashtable_set_destructor( h, ht_destructor );
+    ht_destroyed = 0;
+
+    CHECK( C_hashtable_restore( h, "k0" ) == NULL );
+    CHECK( !C_hashtable_delete( h, "k0" ) );
+    if ( ht_run( h, ref, HT_KEYS, 400000, &size, &n_replaced, &n_deleted ) )
+        return -1;
+    CHECK( C_hashtable_buckets( h ) > C_HASHTABLE_MIN_BUCKETS );
+    CHECK( ht_destroyed == n_replaced + n_deleted );
+
+    // refill it past its load factor to grow while tombstones are left
+    buckets = C_hashtable_buckets( h );
+    while ( C_hashtable_buckets( h ) == buckets ) {
+        char key[16];
+        const int k = HT_KEYS + (int)size;
+
+        sprintf( key, "k%d", k );
+        CHECK( C_hashtable_store( h, key, (void *)1 ) );
+        size++;
+    }
+    CHECK( C_hashtable_size( h ) == size );
+    C_hashtable_destroy( h );
+    CHECK( ht_destroyed == n_replaced + n_deleted + (int)size );
+
+    // long probe sequences
+    memset( ref, 0, sizeof(ref) );
+    size = 0;
+    C_hashtable_set_hashfunc( ht_weak_hash );
+    h = C_hashtable_create( 0 );
+    CHECK( h );
+    if ( ht_run( h, ref, 300, 20000, &size, &n_replaced, &n_deleted ) )
+        return -1;
+    C_hashtable_destroy( h );
+    C_hashtable_set_hashfunc( NULL );
+
+    return 0;
+}
+
+/*
+ * b-tree
+ */
+
+#define BT_KEYS 20000
+#define BT_KEY(k) ( (c_id_t)(k) * 4 + 1 )   // leaves room on both sides
+
+typedef struct {
+    uintptr_t *values;
+    size_t n, max;
+} bt_collect_t;
+
+static int bt_destroyed;
+
+static void bt_destructor( void *data )
+{
+    bt_destroyed++;
+}
+static c_bool_t bt_collect( void *elem, void *hook )
+{
+    bt_collect_t * const c = hook;
+
+    if ( c->n == c->max )
+        return FALSE;
+    c->values[ c->n++ ] = (uintptr_t)elem;
+    return TRUE;
+}
+// the key is in the upper bits of the values stored, each one new
+static uintptr_t bt_value( int k )
+{
+    static uintptr_t generation;
+
+    return (uintptr_t)BT_KEY( k ) << 40 | ++generation << 1 | 1;
+}
+
+/* keys sorted in nodes, within the separators above them, nodes at
+ * least half full but the root, leaves all at the same depth and linked
+ * in order */
+static int bt_check_node( c_btree_t *t, c_btree_node_t *n, int depth,
+                          const c_id_t *lo, const c_id_t *hi,
+                          int *leaf_depth, c_btree_node_t **prev, size_t *n_keys )
+{
+    uint_t i;
+
+    CHECK( n->count <= t->order );
+    CHECK( n == t->root || n->count >= t->order / 2 );
+    for ( i = 0; i < n->count; i++ ) {
+        CHECK( i == 0 || n->keys[i - 1] < n->keys[i] );
+        CHECK( !lo || n->keys[i] >= *lo );
+        CHECK( !hi || n->keys[i] < *hi );
+    }
+    if ( n->leaf ) {
+        if ( *leaf_depth < 0 )
+            *leaf_depth = depth;
+        CHECK( depth == *leaf_depth );
+        CHECK( *prev ? (*prev)->next == n : t->first == n );
+        *prev = n;
+        *n_keys += n->count;
+        return 0;
+    }
+    CHECK( n == t->root ? n->count >= 1 : 1 );
+    for ( i = 0; i <= n->count; i++ )
+        if ( bt_check_node( t, n->children[i], depth + 1,
+                            i > 0 ? &n->keys[i - 1] : lo,
+                            i < n->count ? &n->keys[i] : hi,
+                            leaf_depth, prev, n_keys ) )
+            return -1;
+    return 0;
+}
+static int bt_check_range( c_btree_t *t, const uintptr_t *ref, c_id_t lo, c_id_t hi )
+{
+    static uintptr_t values[ BT_KEYS ];
+    bt_collect_t c = { values, 0, BT_KEYS };
+    size_t n = 0;
+    int k;
+
+    CHECK( C_btree_iterate_range( t, lo, hi, bt_collect, &c ) );
+    for ( k = 0; k < BT_KEYS; k++ ) {
+        if ( !ref[k] || BT_KEY( k ) < lo || BT_KEY( k ) > hi )
+            continue;
+        CHECK( n < c.n && c.values[n] == ref[k] );
+        n++;
+    }
+    CHECK( n == c.n );
+    return 0;
+}
+static int bt_check_all( c_btree_t *t, const uintptr_t *ref, size_t size )
+{
+    static uintptr_t values[ BT_KEYS ];
+    bt_collect_t c = { values, 0, BT_KEYS };
+    c_btree_node_t *prev = NULL;
+    int leaf_depth = -1, k, i;
+    size_t n = 0;
+
+    CHECK( C_btree_size( t ) == size );
+    if ( bt_check_node( t, t->root, 0, NULL, NULL, &leaf_depth, &prev, &n ) )
+        return -1;
+    CHECK( n == size && prev->next == NULL );
+
+    for ( k = 0; k < BT_KEYS; k++ ) {
+        CHECK( (uintptr_t)C_btree_restore( t, BT_KEY( k ) ) == ref[k] );
+        CHECK( C_btree_restore( t, BT_KEY( k ) + 1 ) == NULL );
+    }
+    CHECK( C_btree_restore( t, 0 ) == NULL );
+
+    CHECK( C_btree_iterate( t, bt_collect, &c ) );
+    for ( k = 0, n = 0; k < BT_KEYS; k++ ) {
+        if ( !ref[k] )
+            continue;
+        CHECK( n < c.n && c.values[n] == ref[k] );
+        n++;
+    }
+    CHECK( n == c.n );
+
+    // bounds before, between, after and across all keys, and empty ranges
+    if ( bt_check_range( t, ref, 0, ~(c_id_t)0 ) ||
+         bt_check_range( t, ref, 0, 0 ) ||
+         bt_check_range( t, ref, BT_KEY( BT_KEYS ), ~(c_id_t)0 ) ||
+         bt_check_range( t, ref, BT_KEY( 10 ), BT_KEY( 5 ) ) )
+        return -1;
+    for ( i = 0; i < 20; i++ ) {
+        const c_id_t lo = rng() % ( BT_KEYS * 4 + 8 );
+        const c_id_t hi = lo + rng() % ( i < 10 ? 64 : BT_KEYS * 4 );
+
+        if ( bt_check_range( t, ref, lo, hi ) )
+            return -1;
+    }
+
+    // stopped by the consumer
+    if ( size > 1 ) {
+        c.n = 0;
+        c.max = size / 2;
+        CHECK( !C_btree_iterate( t, bt_collect, &c ) && c.n == size / 2 );
+        c.n = 0;
+        CHECK( !C_btree_iterate_range( t, 0, ~(c_id_t)0, bt_collect, &c ) && c.n == size / 2 );
+    }
+    return 0;
+}
+/* stores with probability store_pct percent, deletes otherwise */
+static int bt_run( c_btree_t *t, uintptr_t *ref, int n_ops, int store_pct,
+                   size_t *size, int *n_freed )
+{
+    int i, k;
+
+    for ( i = 0; i < n_ops; i++ ) {
+        k = rng() % BT_KEYS;
+        if ( (int)( rng() % 100 ) < store_pct ) {
+            const uintptr_t v = bt_value( k );
+
+            CHECK( C_btree_store( t, BT_KEY( k ), (void *)v ) );
+            if ( ref[k] )
+                ( *n_freed )++;
+            else
+                ( *size )++;
+            ref[k] = v;
+        } else {
+            CHECK( C_btree_delete( t, BT_KEY( k ) ) == ( ref[k] != 0 ) );
+            if ( ref[k] ) {
+                ( *size )--;
+                ( *n_freed )++;
+            }
+            ref[k] = 0;
+        }
+        if ( i % 25013 == 0 && bt_check_all( t, ref, *size ) )
+            return -1;
+    }
+    return bt_check_all( t, ref, *size );
+}
+static int test_btree( void )
+{
+    static const uint_t orders[] = { 7, 0, C_BTREE_MAX_ORDER };
+    static const size_t bulk[] = { 0, 1, 7, 8, 63, 1000, BT_KEYS };
+    static uintptr_t ref[ BT_KEYS ];
+    static c_datum_t data[ BT_KEYS ];
+    int n_freed, k;
+    size_t i, j, n, size;
+    c_btree_t *t;
+
+    CHECK( C_btree_create( C_BTREE_MAX_ORDER + 1 ) == NULL );
+
+    for ( i = 0; i < C_lengthof( orders ); i++ ) {
+        t = C_btree_create( orders[i] );
+        CHECK( t && C_btree_order( t ) % C_BTREE_LINE_KEYS == C_BTREE_LINE_KEYS - 1 );
+        C_btree_set_destructor( t, bt_destructor );
+        memset( ref, 0, sizeof(ref) );
+        size = 0;
+        n_freed = bt_destroyed = 0;
+
+        CHECK( !C_btree_store( t, 1, NULL ) );
+        CHECK( !C_btree_delete( t, 1 ) );
+        if ( bt_check_all( t, ref, size ) )
+            return -1;
+        // grow, churn, then shrink to a few keys
+        if ( bt_run( t, ref, 150000, 80, &size, &n_freed ) ||
+             bt_run( t, ref, 100000, 50, &size, &n_freed ) ||
+             bt_run( t, ref, 150000, 10, &size, &n_freed ) )
+            return -1;
+        CHECK( bt_destroyed == n_freed );
+        for ( k = 0; k < BT_KEYS; k++ )
+            if ( ref[k] ) {
+                CHECK( C_btree_delete( t, BT_KEY( k ) ) );
+                ref[k] = 0;
+                size--;
+            }
+        if ( bt_check_all( t, ref, size ) )
+            return -1;
+        CHECK( t->root->leaf && size == 0 );
+        C_btree_destroy( t );
+    }
+
+    // bulk loads, then delete heavy runs from their shape
+    for ( i = 0; i < C_lengthof( orders ); i++ ) {
+        for ( j = 0; j < C_lengthof( bulk ); j++ ) {
+            t = C_btree_create( orders[i] );
+            CHECK( t );
+            C_btree_set_destructor( t, bt_destructor );
+            memset( ref, 0, sizeof(ref) );
+            n_freed = bt_destroyed = 0;
+
+            // every key, or a random subset of them
+            for ( k = 0, n = 0; k < BT_KEYS && n < bulk[j]; k++ ) {
+                if ( bulk[j] < BT_KEYS && rng() % ( BT_KEYS / bulk[j] + 1 ) )
+                    continue;
+                ref[k] = bt_value( k );
+                data[n].key = BT_KEY( k );
+                data[n].value = (void *)ref[k];
+                n++;
+            }
+            if ( n > 1 ) {
+                const c_id_t first = data[0].key;
+
+                data[0].key = data[1].key;
+                CHECK( !C_btree_bulk_load( t, data, n ) );
+                data[0].key = first;
+            }
+            CHECK( C_btree_bulk_load( t, data, n ) );
+            size = n;
+            if ( bt_check_all( t, ref, size ) )
+                return -1;
+            CHECK( n == 0 || !C_btree_bulk_load( t, data, n ) );
+            if ( bt_run( t, ref, 40000, 20, &size, &n_freed ) )
+                return -1;
+            CHECK( bt_destroyed == n_freed );
+            C_btree_destroy( t );
+            CHECK( bt_destroyed == n_freed + (int)size );
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * concurrent hash table
+ */
+
+#define CHT_THREADS 4
+#define CHT_KEYS 2000               // per thread
+#define CHT_OPS 100000
+
+typedef struct {
+    int key;
+} cht_value_t;
+
+typedef struct {
+    c_chashtable_t *h;
+    int id;
+    unsigned long long rng;
+    cht_value_t *ref[ CHT_KEYS ];
+    size_t size;
+    int failed;
+} cht_thread_t;
+
+static int cht_allocated, cht_freed;
+
+static void cht_destructor( void *data )
+{
+    __sync_add_and_fetch( &cht_freed, 1 );
+    free( data );
+}
+
+/* each thread owns its keys, to check them exactly, and reads the
+ * others' under a pin while they are replaced and deleted */
+static int cht_run( cht_thread_t *c )
+{
+    char key[32];
+    int i, k, op, other;
+
+    for ( i = 0; i < CHT_OPS; i++ ) {
+        k = rng_r( &c->rng ) % CHT_KEYS;
+        op = rng_r( &c->rng ) % 100;
+        if ( op < 40 ) {
+            cht_value_t * const v = malloc( sizeof(*v) );
+
+            CHECK( v );
+            v->key = c->id * CHT_KEYS + k;
+            __sync_add_and_fetch( &cht_allocated, 1 );
+            sprintf( key, "t%d.%d", c->id, k );
+            CHECK( C_chashtable_store( c->h, key, v ) );
+            if ( !c->ref[k] )
+                c->size++;
+            c->ref[k] = v;
+        } else if ( op < 70 ) {
+            sprintf( key, "t%d.%d", c->id, k );
+            CHECK( C_chashtable_delete( c->h, key ) == ( c->ref[k] != NULL ) );
+            if ( c->ref[k] )
+                c->size--;
+            c->ref[k] = NULL;
+        } else if ( op < 85 ) {
+            sprintf( key, "t%d.%d", c->id, k );
+            CHECK( C_chashtable_restore( c->h, key ) == c->ref[k] );
+        } else {
+            const cht_value_t * v;
+
+            other = rng_r( &c->rng ) % CHT_THREADS;
+            sprintf( key, "t%d.%d", other, k );
+            C_epoch_pin();
+            v = C_chashtable_restore( c->h, key );
+            if ( v && v->key != other * CHT_KEYS + k ) {
+                C_epoch_unpin();
+                CHECK( !"value of another key" );
+            }
+            C_epoch_unpin();
+        }
+    }
+    return 0;
+}
+static void * cht_thread( void *arg )
+{
+    cht_thread_t * const c = arg;
+
+    c->failed = cht_run( c );
+    return NULL;
+}
+static int test_chashtable( void )
+{
+    static cht_thread_t threads[ CHT_THREADS ];
+    pthread_t tids[ CHT_THREADS ];
+    c_chashtable_t *h;
+    size_t size = 0;
+    char key[32];
+    int i, k;
+
+    h = C_chashtable_create( 0 );
+    CHECK( h && h->table->buckets == C_CHASHTABLE_STRIPES );
+    C_chashtable_set_destructor( h, cht_destructor );
+    cht_allocated = cht_freed = 0;
+
+    for ( i = 0; i < CHT_THREADS; i++ ) {
+        memset( &threads[i], 0, sizeof(threads[i]) );
+        threads[i].h = h;
+        threads[i].id = i;
+        threads[i].rng = rng() | 1ULL << 32;
+        CHECK( pthread_create( &tids[i], NULL, cht_thread, &threads[i] ) == 0 );
+    }
+    for ( i = 0; i < CHT_THREADS; i++ ) {
+        pthread_join( tids[i], NULL );
+        CHECK( !threads[i].failed );
+        size += threads[i].size;
+    }
+
+    // grown while in use
+    CHECK( h->table->buckets > C_CHASHTABLE_STRIPES );
+    CHECK( C_chashtable_size( h ) == size );
+    for ( i = 0; i < CHT_THREADS; i++ )
+        for ( k = 0; k < CHT_KEYS; k++ ) {
+            sprintf( key, "t%d.%d", i, k );
+            CHECK( C_chashtable_restore( h, key ) == threads[i].ref[k] );
+        }
+
+    C_chashtable_destroy( h );
+    CHECK( cht_freed == cht_allocated );
+
+    return 0;
+}
+
+/*
+ * queue
+ */
+
+#define Q_PRODUCERS 4
+#define Q_CONSUMERS 4
+#define Q_ITEMS 200000              // per producer
+#define Q_ITEM(p, i) ( (void *)( (uintptr_t)(p) << 32 | ( (uintptr_t)(i) + 1 ) ) )
+
+typedef struct {
+    c_queue_t *q;
+    int id;
+    int failed;
+} q_thread_t;
+
+static unsigned char q_seen[ Q_PRODUCERS ][ Q_ITEMS ];
+static int q_consumed, q_destroyed;
+
+static void q_destructor( void *data )
+{
+    q_destroyed++;
+}
+static void * q_producer( void *arg )
+{
+    q_thread_t * const t = arg;
+    int i;
+
+    for ( i = 0; i < Q_ITEMS; i++ )
+        if ( !C_queue_enqueue( t->q, Q_ITEM( t->id, i ) ) )
+            t->failed = 1;
+    return NULL;
+}
+/* every item once, and in the order of its producer */
+static int q_consume( q_thread_t *t )
+{
+    int last[ Q_PRODUCERS ], p, i;
+    uintptr_t data;
+
+    memset( last, -1, sizeof(last) );
+    while ( __atomic_load_n( &q_consumed, __ATOMIC_RELAXED ) < Q_PRODUCERS * Q_ITEMS ) {
+        if ( !( data = (uintptr_t)C_queue_dequeue( t->q ) ) ) {
+            sched_yield();
+            continue;
+        }
+        p = data >> 32;
+        i = ( data & 0xFFFFFFFF ) - 1;
+        CHECK( p >= 0 && p < Q_PRODUCERS && i >= 0 && i < Q_ITEMS );
+        CHECK( i > last[p] );
+        last[p] = i;
+        CHECK( __sync_add_and_fetch( &q_seen[p][i], 1 ) == 1 );
+        __atomic_add_fetch( &q_consumed, 1, __ATOMIC_RELAXED );
+    }
+    return 0;
+}
+static void * q_consumer( void *arg )
+{
+    q_thread_t * const t = arg;
+
+    t->failed = q_consume( t );
+    return NULL;
+}
+static int test_queue( void )
+{
+    static q_thread_t threads[ Q_PRODUCERS + Q_CONSUMERS ];
+    pthread_t tids[ Q_PRODUCERS + Q_CONSUMERS ];
+    c_queueseg_t *segs[ 64 ];
+    int i, p, n, n_segs = 0;
+    c_queue_t *q;
+
+    q = C_queue_create();
+    CHECK( q && C_queue_dequeue( q ) == NULL && C_queue_length( q ) == 0 );
+
+    // FIFO across segments, from one thread
+    n = 3 * C_QUEUE_SEGMENT + 5;
+    for ( i = 0; i < n; i++ )
+        CHECK( C_queue_enqueue( q, Q_ITEM( 0, i ) ) );
+    CHECK( C_queue_length( q ) == (size_t)n );
+    for ( i = 0; i < n; i++ )
+        CHECK( C_queue_dequeue( q ) == Q_ITEM( 0, i ) );
+    CHECK( C_queue_dequeue( q ) == NULL && C_queue_length( q ) == 0 );
+
+    // in lock step through many segments, which are reused
+    for ( i = 0; i < 200 * C_QUEUE_SEGMENT; i++ ) {
+        CHECK( C_queue_enqueue( q, Q_ITEM( 0, i ) ) );
+        CHECK( C_queue_dequeue( q ) == Q_ITEM( 0, i ) );
+        if ( i % C_QUEUE_SEGMENT == 0 ) {
+            for ( p = 0; p < n_segs && segs[p] != q->tail; p++ )
+                ;
+            // far fewer than the 200 segments gone through
+            CHECK( p < (int)C_lengthof( segs ) );
+            if ( p == n_segs )
+                segs[ n_segs++ ] = q->tail;
+        }
+    }
+    CHECK( q->nspare <= C_QUEUE_SPARE );
+
+    // from many threads
+    memset( q_seen, 0, sizeof(q_seen) );
+    q_consumed = 0;
+    for ( i = 0; i < Q_PRODUCERS + Q_CONSUMERS; i++ ) {
+        threads[i].q = q;
+        threads[i].id = i < Q_PRODUCERS ? i : i - Q_PRODUCERS;
+        threads[i].failed = 0;
+        CHECK( pthread_create( &tids[i], NULL,
+                               i < Q_PRODUCERS ? q_producer : q_consumer, &threads[i] ) == 0 );
+    }
+    for ( i = 0; i < Q_PRODUCERS + Q_CONSUMERS; i++ ) {
+        pthread_join( tids[i], NULL );
+        CHECK( !threads[i].failed );
+    }
+    for ( p = 0; p < Q_PRODUCERS; p++ )
+        for ( i = 0; i < Q_ITEMS; i++ )
+            CHECK( q_seen[p][i] == 1 );
+    CHECK( C_queue_dequeue( q ) == NULL && C_queue_length( q ) == 0 );
+
+    // what is left goes to the destructor
+    C_queue_set_destructor( q, q_destructor );
+    q_destroyed = 0;
+    for ( i = 0; i < C_QUEUE_SEGMENT + 1; i++ )
+        CHECK( C_queue_enqueue( q, Q_ITEM( 0, i ) ) );
+    CHECK( C_queue_dequeue( q ) == Q_ITEM( 0, 0 ) );
+    C_queue_destroy( q );
+    CHECK( q_destroyed == C_QUEUE_SEGMENT );
+
+    return 0;
+}
+
+/*
+ * dynamic string
+ */
+
+#define DS_MAX ( 1 << 19 )
+
+static char ds_ref[ DS_MAX ];
+static size_t ds_len, ds_p;
+
+static void ds_random( char *s, size_t n )
+{
+    size_t i;
+
+    for ( i = 0; i < n; i++ )
+        s[i] = rng() % 16 ? 'a' + rng() % 26 : '\n';
+}
+/* the bytes, chunk by chunk, are the reference's */
+static int ds_check( c_dstring_t *d )
+{
+    size_t o, n;
+    char *c;
+    uint_t i;
+
+    CHECK( (size_t)C_dstring_length( d ) == ds_len && (size_t)d->p == ds_p );
+    for ( i = 0, o = 0; ( c = C_dstring_chunk( d, i, &n ) ); i++, o += n ) {
+        CHECK( n > 0 && o + n <= ds_len && !memcmp( c, ds_ref + o, n ) );
+        CHECK( !C_dstring_ischunked( d ) || o + n == ds_len || n == d->blocksz );
+    }
+    CHECK( o == ds_len );
+    if ( !C_dstring_ischunked( d ) )
+        CHECK( C_dstring_data( d )[ ds_len ] == NUL );
+    return 0;
+}
+static int ds_run( c_dstring_t *d, int n_ops, size_t max_len )
+{
+    char buf[ 512 ], *s;
+    size_t n, want, i;
+    off_t o;
+    int op, k;
+
+    for ( k = 0; k < n_ops; k++ ) {
+        op = rng() % 100;
+        if ( op < 40 && ds_p + sizeof(buf) < max_len ) {
+            // at the end mostly, over what is there otherwise
+            if ( rng() % 4 ) {
+                CHECK( C_dstring_append( d ) );
+                ds_p = ds_len;
+            }
+            n = rng() % sizeof(buf);
+            ds_random( buf, n );
+            CHECK( C_dstring_puts_len( d, buf, n ) );
+            memcpy( ds_ref + ds_p, buf, n );
+            ds_p += n;
+            if ( ds_p > ds_len )
+                ds_len = ds_p;
+        } else if ( op < 50 && ds_p + 1 < max_len ) {
+            ds_random( buf, 1 );
+            CHECK( C_dstring_putc( d, buf[0] ) );
+            ds_ref[ ds_p++ ] = buf[0];
+            if ( ds_p > ds_len )
+                ds_len = ds_p;
+        } else if ( op < 60 ) {
+            CHECK( C_dstring_getc( d ) == ( ds_p < ds_len ? ds_ref[ ds_p ] : NUL ) );
+            if ( ds_p < ds_len )
+                ds_p++;
+        } else if ( op < 75 ) {
+            n = 1 + rng() % sizeof(buf);
+            s = C_dstring_gets( d, buf, n, '\n' );
+            if ( ds_p >= ds_len ) {
+                CHECK( s == NULL );
+                continue;
+            }
+            want = ds_len - ds_p < n - 1 ? ds_len - ds_p : n - 1;
+            for ( i = 0; i < want && ds_ref[ ds_p + i ] != '\n'; i++ )
+                ;
+            if ( i < want )
+                i++;
+            CHECK( s == buf && strlen( buf ) == i && !memcmp( buf, ds_ref + ds_p, i ) );
+            ds_p += i;
+        } else if ( op < 90 ) {
+            const int whence = rng() % 3;
+
+            o = (off_t)( rng() % ( ds_len + 3 ) ) - 1;
+            if ( whence == C_DSTRING_SEEK_REL )
+                o -= ds_p;
+            else if ( whence == C_DSTRING_SEEK_END )
+                o -= ds_len;
+            n = whence == C_DSTRING_SEEK_ABS ? 0 : whence == C_DSTRING_SEEK_REL ? ds_p : ds_len;
+            if ( (off_t)n + o < 0 || (size_t)( n + o ) > ds_len ) {
+                CHECK( !C_dstring_seek( d, o, whence ) );
+            } else {
+                CHECK( C_dstring_seek( d, o, whence ) );
+                ds_p = n + o;
+            }
+        } else if ( op < 92 ) {
+            n = rng() % ( ds_len + 2 );
+            CHECK( C_dstring_trunc( d, n ) == ( n <= ds_len ) );
+            if ( n <= ds_len ) {
+                ds_len = n;
+                if ( ds_p > ds_len )
+                    ds_p = ds_len;
+            }
+        }
+        if ( k % 997 == 0 && ds_check( d ) )
+            return -1;
+    }
+    return ds_check( d );
+}
+static int ds_destroy( c_dstring_t *d )
+{
+    char * const s = C_dstring_destroy( d );
+
+    CHECK( s && strlen( s ) == ds_len && !memcmp( s, ds_ref, ds_len ) );
+    C_free( s );
+    return 0;
+}
+/* saved, loaded back mapped, changed, saved over the file it maps */
+static int ds_round_trip( c_dstring_t *d, const char *path )
+{
+    uint_t blocksz = d->blocksz;
+
+    CHECK( C_dstring_save( d, path ) );
+    if ( ds_destroy( d ) )
+        return -1;
+
+    CHECK( ( d = C_dstring_load( path, blocksz ) ) );
+    CHECK( ds_len == 0 || d->mapped > ds_len );
+    ds_p = 0;
+    if ( ds_check( d ) )
+        return -1;
+
+    // in place, within the mapping, which leaves the file alone
+    if ( ds_len > 2 ) {
+        char c;
+        int fd;
+
+        CHECK( C_dstring_seek( d, ds_len / 2, C_DSTRING_SEEK_ABS ) );
+        CHECK( C_dstring_putc( d, '#' ) );
+        ds_p = ds_len / 2 + 1;
+        CHECK( ( fd = open( path, O_RDONLY ) ) >= 0 );
+        CHECK( pread( fd, &c, 1, ds_len / 2 ) == 1 );
+        close( fd );
+        CHECK( c == ds_ref[ ds_len / 2 ] );
+        ds_ref[ ds_len / 2 ] = '#';
+        if ( ds_check( d ) )
+            return -1;
+    }
+    CHECK( C_dstring_save( d, path ) );
+    if ( ds_destroy( d ) )
+        return -1;
+
+    // and past it, off to the heap
+    CHECK( ( d = C_dstring_load( path, blocksz ) ) );
+    ds_p = 0;
+    if ( ds_check( d ) || ds_run( d, 2000, DS_MAX ) )
+        return -1;
+    return ds_destroy( d );
+}
+static int test_dstring( void )
+{
+    static const size_t sizes[] = { 0, 1, 4095, 4096, 4097, 100000 };
+    char path[] = "/tmp/testdata.XXXXXX";
+    c_dstring_t *d;
+    char *chunk0;
+    uint_t blk, n_grown;
+    size_t i, n;
+    int fd;
+
+    CHECK( C_dstring_create( C_DSTRING_MIN_BLOCKSZ - 1 ) == NULL );
+    CHECK( C_dstring_create_chunked( C_DSTRING_MIN_BLOCKSZ - 1 ) == NULL );
+    CHECK( ( fd = mkstemp( path ) ) >= 0 );
+    close( fd );
+
+    // doubling rather than block by block
+    CHECK( ( d = C_dstring_create( C_DSTRING_MIN_BLOCKSZ ) ) );
+    for ( i = 0, blk = d->blk, n_grown = 0; i < DS_MAX; i++ ) {
+        CHECK( C_dstring_putc( d, 'a' + i % 26 ) );
+        if ( d->blk != blk )
+            n_grown++;
+        blk = d->blk;
+    }
+    CHECK( n_grown < 16 );
+    free( C_dstring_destroy( d ) );
+
+    // random edits, and appends across chunk boundaries which never move chunks
+    for ( i = 0; i < 2; i++ ) {
+        d = i ? C_dstring_create_chunked( C_DSTRING_MIN_BLOCKSZ )
+              : C_dstring_create( C_DSTRING_MIN_BLOCKSZ );
+        CHECK( d && C_dstring_ischunked( d ) == (c_bool_t)i );
+        ds_len = ds_p = 0;
+        if ( ds_check( d ) || ds_run( d, 200, DS_MAX ) )
+            return -1;
+        chunk0 = C_dstring_chunk( d, 0, &n );
+        if ( ds_run( d, 20000, DS_MAX / 2 ) )
+            return -1;
+        CHECK( !i || !chunk0 || C_dstring_chunk( d, 0, &n ) == chunk0 );
+        if ( ds_round_trip( d, path ) )
+            goto failed;
+    }
+
+    // files of sizes around a page
+    for ( i = 0; i < C_lengthof( sizes ); i++ ) {
+        CHECK( ( d = C_dstring_create( C_DSTRING_LOAD_BLOCKSZ ) ) );
+        ds_random( ds_ref, sizes[i] );
+        CHECK( C_dstring_puts_len( d, ds_ref, sizes[i] ) );
+        ds_len = ds_p = sizes[i];
+        if ( ds_round_trip( d, path ) )
+            goto failed;
+    }
+
+    unlink( path );
+    return 0;
+
+failed:
+    unlink( path );
+    return -1;
+}
+
+/*
+ * dynamic array
+ */
+
+#define DA_ELEMS 200005              // the last free list word partly used
+
+typedef struct {
+    uint_t index;                   // the one iterated from
+    unsigned char *seen;
+    int n, failed;
+} da_iter_t;
+
+static c_bool_t da_iter( void *elem, uint_t offset, void *hook )
+{
+    da_iter_t * const it = hook;
+    const uint_t index = *(uint_t *)elem;
+
+    // iterators are given the offset from the index iterated from
+    if ( index != it->index + offset || it->seen[ index ]++ )
+        it->failed = 1;
+    __sync_add_and_fetch( &it->n, 1 );
+    return TRUE;
+}
+/* saved and mapped back, and a free list with bits at or above bot,
+ * which would have holes reused past the mapped elements, refused */
+static int da_map( c_darray_t *a )
+{
+    char path[] = "/tmp/testdata.XXXXXX";
+    const uint_t bot = C_darray_last( a );
+    const off_t last_word = C_DARRAY_FILE_HEADER + ( bot - 1 ) / 64 * sizeof(uint64_t);
+    uint64_t word, bad;
+    c_darray_t *m;
+    uint_t i;
+    void *e;
+    int fd;
+
+    CHECK( bot % 64 && C_darray_size( a ) < bot );
+    CHECK( ( fd = mkstemp( path ) ) >= 0 );
+    if ( !C_darray_save( a, path ) ) {
+        close( fd );
+        unlink( path );
+        CHECK( !"saved" );
+    }
+    close( fd );
+
+    m = C_darray_map( path, C_DARRAY_MAP_PRIVATE );
+    CHECK( m && C_darray_last( m ) == bot && C_darray_size( m ) == C_darray_size( a ) );
+    for ( i = 0; i < bot; i++ ) {
+        e = C_darray_restore( a, i );
+        CHECK( e ? *(uint_t *)C_darray_restore( m, i ) == i : !C_darray_restore( m, i ) );
+    }
+    C_darray_destroy( m );
+
+    CHECK( ( fd = open( path, O_RDWR ) ) >= 0 );
+    CHECK( pread( fd, &word, sizeof(word), last_word ) == sizeof(word) );
+    bad = word | (uint64_t)1 << ( bot % 64 );
+    CHECK( pwrite( fd, &bad, sizeof(bad), last_word ) == sizeof(bad) );
+    close( fd );
+    m = C_darray_map( path, C_DARRAY_MAP_PRIVATE );
+    unlink( path );
+    CHECK( m == NULL );
+
+    return 0;
+}
+/*
+ * holes are reused lowest first, found through the summary of the free
+ * list, a bit per word, across many summary words
+ */
+
+#define DH_ELEMS 70000               // 18 summary words
+#define DH_OPS 100000
+
+static int da_holes( void )
+{
+    static const uint_t edges[] = {
+        0, 1, 63, 64, 4095, 4096, 4097, 8191, 65535, 65536, DH_ELEMS - 1,
+    };
+    static unsigned char live[ DH_ELEMS ];
+    c_darray_t *a;
+    uint_t i, index, lowest, n;
+    int j, op;
+
+    CHECK( ( a = C_darray_create( C_DARRAY_MAX_RESIZE, sizeof(uint_t) ) ) );
+    for ( i = 0; i < DH_ELEMS; i++ ) {
+        CHECK( C_darray_store( a, &i, &index ) && index == i );
+        live[i] = 1;
+    }
+
+    // word and summary word edges, deleted highest first
+    for ( j = C_lengthof( edges ); j-- > 0; )
+        CHECK( C_darray_delete( a, edges[j] ) );
+    for ( j = 0; j < (int)C_lengthof( edges ); j++ )
+        CHECK( C_darray_store( a, &edges[j], &index ) && index == edges[j] );
+
+    for ( lowest = DH_ELEMS, n = DH_ELEMS, op = 0; op < DH_OPS; op++ ) {
+        // more deletes than stores, for holes to spread
+        if ( lowest == DH_ELEMS || rng() % 3 ) {
+            i = rng() % DH_ELEMS;
+            CHECK( C_darray_delete( a, i ) == live[i] );
+            n -= live[i];
+            live[i] = 0;
+            if ( i < lowest )
+                lowest = i;
+        } else {
+            CHECK( C_darray_store( a, &lowest, &index ) && index == lowest );
+            live[ index ] = 1;
+            n++;
+            while ( lowest < DH_ELEMS && live[ lowest ] )
+                lowest++;
+        }
+    }
+    CHECK( C_darray_last( a ) == DH_ELEMS && C_darray_size( a ) == n );
+    C_darray_destroy( a );
+
+    return 0;
+}
+
+/*
+ * compaction against a model: live elements keep their order, the
+ * remap table tells where each went
+ */
+
+#define DC_ELEMS 5000
+#define DC_ROUNDS 20
+
+static uint_t dc_ref[ DC_ELEMS ], dc_remap[ DC_ELEMS ], dc_bot;
+static unsigned char dc_live[ DC_ELEMS ];
+
+static int dc_check( c_darray_t *a )
+{
+    uint_t i, n = 0;
+    void *e;
+
+    CHECK( C_darray_last( a ) == dc_bot );
+    for ( i = 0; i < dc_bot; i++ ) {
+        e = C_darray_restore( a, i );
+        CHECK( dc_live[i] ? e && *(uint_t *)e == dc_ref[i] : !e );
+        n += dc_live[i];
+    }
+    CHECK( C_darray_size( a ) == n );
+    return 0;
+}
+static int dc_churn( c_darray_t *a, int n_ops )
+{
+    uint_t v, index;
+
+    while ( n_ops-- > 0 ) {
+        if ( C_darray_last( a ) < DC_ELEMS && rng() % 3 ) {
+            v = rng();
+            CHECK( C_darray_store( a, &v, &index ) );
+            CHECK( index <= dc_bot && ( index == dc_bot || !dc_live[ index ] ) );
+            dc_ref[ index ] = v;
+            dc_live[ index ] = 1;
+            if ( index == dc_bot )
+                dc_bot++;
+        } else if ( dc_bot ) {
+            index = rng() % dc_bot;
+            CHECK( C_darray_delete( a, index ) == dc_live[ index ] );
+            dc_live[ index ] = 0;
+        }
+    }
+    return 0;
+}
+/* the model compacted, remap checked against it unless NULL */
+static int dc_compacted( const uint_t *remap )
+{
+    uint_t i, n = 0;
+
+    for ( i = 0; i < dc_bot; i++ ) {
+        if ( !dc_live[i] ) {
+            CHECK( !remap || remap[i] == C_DARRAY_NONE );
+            continue;
+        }
+        CHECK( !remap || remap[i] == n );
+        dc_ref[ n++ ] = dc_ref[i];
+    }
+    memset( dc_live, 1, n );
+    memset( dc_live + n, 0, dc_bot - n );
+    dc_bot = n;
+    return 0;
+}
+static int dc_compact( c_darray_t *a )
+{
+    CHECK( C_darray_compact( a, dc_remap ) );
+    return dc_compacted( dc_remap ) || dc_check( a );
+}
+/* one at least, for compaction to have something to do */
+static int dc_hole( c_darray_t *a )
+{
+    const uint_t i = dc_bot / 2;
+
+    CHECK( dc_bot );
+    if ( dc_live[i] ) {
+        CHECK( C_darray_delete( a, i ) );
+        dc_live[i] = 0;
+    }
+    return 0;
+}
+/* saved aside and mapped back in mode */
+static c_darray_t * dc_map( c_darray_t *a, int mode )
+{
+    char path[] = "/tmp/testdata.XXXXXX";
+    c_darray_t *m = NULL;
+    int fd;
+
+    if ( ( fd = mkstemp( path ) ) < 0 )
+        return NULL;
+    close( fd );
+    if ( C_darray_save( a, path ) )
+        m = C_darray_map( path, mode );
+    unlink( path );
+    return m;
+}
+/* on the heap, on a copy-on-write mapping, then a read-only mapping
+ * defragmented into a copy */
+static int da_compact( void )
+{
+    c_darray_t *a, *m, *d;
+    int round;
+
+    dc_bot = 0;
+    memset( dc_live, 0, sizeof(dc_live) );
+    CHECK( ( a = C_darray_create( 1, sizeof(uint_t) ) ) );
+    for ( round = 0; round < DC_ROUNDS; round++ ) {
+        if ( dc_churn( a, rng() % 2000 ) || dc_check( a ) )
+            return -1;
+        if ( round % 2 ) {
+            CHECK( C_darray_defragment( a ) == a );
+            if ( dc_compacted( NULL ) || dc_check( a ) )
+                return -1;
+        } else if ( dc_compact( a ) ) {
+            return -1;
+        }
+    }
+    // nothing to move
+    if ( dc_compact( a ) )
+        return -1;
+
+    if ( dc_churn( a, 3000 ) )
+        return -1;
+    if ( dc_hole( a ) )
+        return -1;
+    CHECK( ( m = dc_map( a, C_DARRAY_MAP_PRIVATE ) ) );
+    C_darray_destroy( a );
+    // compacted in the mapping, then grown off it
+    if ( dc_check( m ) || dc_compact( m ) || dc_churn( m, 4000 ) || dc_check( m ) )
+        return -1;
+
+    if ( dc_hole( m ) )
+        return -1;
+    CHECK( ( d = dc_map( m, C_DARRAY_MAP_RDONLY ) ) );
+    C_darray_destroy( m );
+    CHECK( !C_darray_compact( d, dc_remap ) );
+    if ( dc_check( d ) )
+        return -1;
+    CHECK( ( d = C_darray_defragment( d ) ) );
+    if ( dc_compacted( NULL ) || dc_check( d ) || dc_churn( d, 1000 ) || dc_check( d ) )
+        return -1;
+    C_darray_destroy( d );
+
+    return 0;
+}
+static int test_darray( void )
+{
+    static const uint_t from[] = { 0, 1, 63, 64, 1000, 70001, DA_ELEMS - 1, DA_ELEMS, DA_ELEMS + 5 };
+    static unsigned char live[ DA_ELEMS ], seen[ DA_ELEMS ];
+    da_iter_t it = { 0, seen };
+    c_darray_t *a;
+    uint_t i, j, k, index;
+    int n, parallel;
+
+    CHECK( ( a = C_darray_create( C_DARRAY_MAX_RESIZE, sizeof(uint_t) ) ) );
+    for ( i = 0; i < DA_ELEMS; i++ ) {
+        CHECK( C_darray_store( a, &i, &index ) && index == i );
+        live[i] = 1;
+    }
+    // runs of deleted elements as well as scattered ones
+    for ( i = 0; i < DA_ELEMS; i++ )
+        if ( ( i / 1000 ) % 7 == 3 || rng() % 3 == 0 ) {
+            CHECK( C_darray_delete( a, i ) );
+            live[i] = 0;
+        }
+
+    for ( parallel = 0; parallel < 2; parallel++ )
+        for ( j = 0; j < C_lengthof( from ); j++ ) {
+            memset( seen, 0, sizeof(seen) );
+            it.index = from[j];
+            it.n = it.failed = 0;
+            if ( parallel )
+                CHECK( C_darray_iterate_parallel( a, da_iter, from[j], &it, 4 ) );
+            else
+                CHECK( C_darray_iterate( a, da_iter, from[j], &it ) );
+            CHECK( !it.failed );
+            for ( k = from[j], n = 0; k < DA_ELEMS; k++ ) {
+                CHECK( seen[k] == live[k] );
+                n += live[k];
+            }
+            CHECK( it.n == n );
+        }
+
+    if ( da_map( a ) )
+        return -1;
+    C_darray_destroy( a );
+    if ( da_holes() || da_compact() )
+        return -1;
+    return 0;
+}
+
+/*
+ * linked list
+ */
+
+#define LL_MAX 1000
+#define LL_OPS 100000
+#define LL_SLABS(n) ( ( (n) + C_LINKLIST_SLAB - 2 ) / ( C_LINKLIST_SLAB - 1 ) )
+#define LL_INT(i) ( (void *)(uintptr_t)(i) )
+
+typedef struct {
+    int k, stop, failed;
+} ll_iter_t;
+
+static void *ll_ref[ LL_MAX ];
+static int ll_n, ll_destroyed;
+static uintptr_t ll_next;
+
+static void ll_destructor( void *data )
+{
+    ll_destroyed++;
+}
+static void * ll_data( void )
+{
+    return (void *)++ll_next;
+}
+/* the first link of each slab chains them, the others are handed out */
+static int ll_slabs( c_linklist_t *l )
+{
+    c_link_t *s;
+    int n = 0;
+
+    for ( s = l->slabs; s; s = s->next )
+        n++;
+    return n;
+}
+static c_bool_t ll_iter( void *data, void *hook )
+{
+    ll_iter_t * const it = hook;
+
+    if ( it->k >= ll_n || data != ll_ref[ it->k ] )
+        it->failed = 1;
+    return ++it->k != it->stop;
+}
+static int ll_check( c_linklist_t *l )
+{
+    ll_iter_t it = { 0, -1 };
+    c_link_t *p;
+    void *d;
+    int i = 0;
+
+    CHECK( C_linklist_size( l ) == (size_t)ll_n );
+    C_linklist_foreach_r( l, &p, d )
+        CHECK( i < ll_n && d == ll_ref[ i++ ] );
+    CHECK( i == ll_n );
+    for ( p = C_linklist_tail( l ); p; p = C_link_prev( p ) )
+        CHECK( i > 0 && C_link_data( p ) == ll_ref[ --i ] );
+    CHECK( i == 0 );
+
+    CHECK( C_linklist_iterate( l, ll_iter, &it ) && !it.failed && it.k == ll_n );
+    if ( ll_n ) {
+        it.k = 0;
+        it.stop = 1 + rng() % ll_n;
+        CHECK( !C_linklist_iterate( l, ll_iter, &it ) && !it.failed && it.k == it.stop );
+    }
+    return 0;
+}
+static void ll_insert( int pos, void *data )
+{
+    memmove( &ll_ref[ pos + 1 ], &ll_ref[ pos ], ( ll_n - pos ) * sizeof(void *) );
+    ll_ref[ pos ] = data;
+    ll_n++;
+}
+static void ll_remove( int pos )
+{
+    ll_n--;
+    memmove( &ll_ref[ pos ], &ll_ref[ pos + 1 ], ( ll_n - pos ) * sizeof(void *) );
+}
+/* the cursor on pos, the end for ll_n */
+static int ll_seek( c_linklist_t *l, int pos )
+{
+    CHECK( C_linklist_move_head( l ) );
+    while ( pos-- > 0 )
+        CHECK( C_linklist_move_next( l ) );
+    return 0;
+}
+static int ll_run( c_linklist_t *l, int n_ops, int *peak )
+{
+    void *d;
+    int pos;
+
+    while ( n_ops-- > 0 ) {
+        switch ( rng() % 6 ) {
+        case 0:
+            if ( ll_n == LL_MAX )
+                break;
+            d = ll_data();
+            CHECK( C_linklist_append( l, d ) );
+            ll_insert( ll_n, d );
+            break;
+        case 1:
+            if ( ll_n == LL_MAX )
+                break;
+            d = ll_data();
+            CHECK( C_linklist_prepend( l, d ) );
+            ll_insert( 0, d );
+            break;
+        case 2:
+            d = C_linklist_pop( l );
+            CHECK( ll_n ? d == ll_ref[0] : !d );
+            if ( ll_n )
+                ll_remove( 0 );
+            break;
+        case 3:
+            if ( ll_n == LL_MAX )
+                break;
+            pos = rng() % ( ll_n + 1 );
+            d = ll_data();
+            if ( ll_seek( l, pos ) )
+                return -1;
+            CHECK( C_linklist_store( l, d ) && C_linklist_restore( l ) == d );
+            ll_insert( pos, d );
+            break;
+        case 4:
+            if ( !ll_n )
+                break;
+            pos = rng() % ll_n;
+            if ( ll_seek( l, pos ) )
+                return -1;
+            CHECK( C_linklist_delete( l ) );
+            ll_remove( pos );
+            CHECK( C_linklist_restore( l ) == ( pos < ll_n ? ll_ref[ pos ] : NULL ) );
+            break;
+        default:
+            CHECK( !C_linklist_search( l, (void *)( ll_next + 1 ) ) );
+            if ( ll_n )
+                CHECK( C_linklist_search( l, ll_ref[ rng() % ll_n ] ) );
+        }
+        if ( ll_n > *peak )
+            *peak = ll_n;
+    }
+    return 0;
+}
+static int test_linklist( void )
+{
+    const int n = 3 * C_LINKLIST_SLAB;
+    c_linklist_t *l;
+    int i, round, peak = 0, deleted;
+
+    // a stack, over a few slabs, then again out of the same ones
+    CHECK( ( l = C_stack_create() ) );
+    for ( round = 0; round < 2; round++ ) {
+        for ( i = 1; i <= n; i++ ) {
+            CHECK( C_stack_push( l, LL_INT( i ) ) && C_stack_peek( l ) == LL_INT( i ) );
+            CHECK( ll_slabs( l ) == LL_SLABS( round ? n : i ) );
+        }
+        CHECK( C_stack_depth( l ) == (size_t)n );
+        for ( i = n; i >= 1; i-- )
+            CHECK( C_stack_pop( l ) == LL_INT( i ) );
+        CHECK( !C_stack_pop( l ) && !C_stack_peek( l ) );
+    }
+    C_stack_destroy( l );
+
+    // a queue, the same way
+    CHECK( ( l = C_linklist_create() ) );
+    for ( round = 0; round < 2; round++ ) {
+        for ( i = 1; i <= n; i++ ) {
+            CHECK( C_linklist_append( l, LL_INT( i ) ) );
+            CHECK( ll_slabs( l ) == LL_SLABS( round ? n : i ) );
+        }
+        for ( i = 1; i <= n; i++ )
+            CHECK( C_linklist_pop( l ) == LL_INT( i ) );
+        CHECK( !C_linklist_pop( l ) && C_linklist_size( l ) == 0 );
+    }
+    C_linklist_destroy( l );
+
+    // anywhere through the cursor, against the model
+    ll_n = ll_destroyed = 0;
+    CHECK( ( l = C_linklist_create() ) && C_linklist_set_destructor( l, ll_destructor ) );
+    for ( i = 0; i < 10; i++ )
+        if ( ll_run( l, LL_OPS / 10, &peak ) || ll_check( l ) )
+            return -1;
+    CHECK( ll_slabs( l ) == LL_SLABS( peak ) );
+    deleted = ll_destroyed;
+    C_linklist_destroy( l );
+    CHECK( ll_destroyed == deleted + ll_n );
+
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    static const struct {
+        const char *name;
+        int (*test)( void );
+    } tests[] = {
+        { "darray", test_darray },
+        { "linklist", test_linklist },
+        { "hashtable", test_hashtable },
+        { "btree", test_btree },
+        { "chashtable", test_chashtable },
+        { "queue", test_queue },
+        { "dstring", test_dstring },
+    };
+    const unsigned long long seed = argc > 1 ? strtoull( argv[1], NULL, 0 ) : 20121218;
+    int i, failed = 0;
+
+    for ( i = 0; i < (int)C_lengthof( tests ); i++ ) {
+        rng_state = seed * 0x9E3779B97F4A7C15ULL | 1;
+        if ( tests[i].test() ) {
+            printf( "%s: FAILED (seed %llu)\n", tests[i].name, seed );
+            failed++;
+        } else {
+            printf( "%s: ok\n", tests[i].name );
+        }
+    }
+
+    return failed ? -1 : 0;
+}
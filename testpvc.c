@@ -33,6 +33,7 @@
 #endif
 
 typedef struct {
+    pvc_t pvc;
     int running;
     int acc_max;
     int acc;
@@ -44,7 +45,11 @@ static int produce_data( void *ctx, void **pdata )
 {
     const pvc_info_t * const info = pvc_get_info();
     prog_context_t * const c = ctx;
-    int *value = malloc( sizeof(int) );
+    int *value = pvc_pool_get( c->pvc );
+    if ( !value ) {
+        *pdata = NULL;
+        return -1;
+    }
     *value = 1 + c->acc;
     c->acc = ( c->acc + 1 ) % c->acc_max;
     *pdata = value;
@@ -59,7 +64,7 @@ static int consume_data( void *ctx, void *data )
     int *value = data;
     //usleep( 1313 ); // to simulate I/O blocking
     printf( "C#%d:\tthread #%d(C%d): tid=%p, consume %d(%p)\n", ++c->counter_c, info->index, info->sub_index, pthread_self(), *value, value );
-    free( value );
+    pvc_pool_put( c->pvc, value );
     return 0;
 }
 
@@ -89,7 +94,7 @@ static void handle_signals( void (*func)( int ), ... )
 
 int main( int argc, char *argv[] )
 {
-    prog_context_t ctx = { 1 };
+    prog_context_t ctx = { NULL, 1 };
     size_t n_max_elems;
     int n_producer, n_consumer;
     pvc_t pvc;
@@ -114,6 +119,10 @@ int main( int argc, char *argv[] )
     printf( "using pvc: rb-max-elems=%zd, producers=%d, consumers=%d\n", n_max_elems, n_producer, n_consumer );
 
     pvc = pvc_open( n_max_elems );
+    ctx.pvc = pvc;
+
+    // the ring, one element per callback, and the thread caches
+    pvc_set_pool( pvc, sizeof(int), n_max_elems + ( n_producer + n_consumer + 1 ) * ( PVC_POOL_CACHE + 1 ) );
 
     pvc_add_producer( pvc, produce_data, n_producer );
     pvc_add_consumer( pvc, consume_data, n_consumer );
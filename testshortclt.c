@@ -42,6 +42,7 @@
 typedef struct {
     int *running;
     int *threads;
+    pvc_t pool;
     struct sockaddr_in toaddr;
     uint32_t gen_seq, xmit_seq, recv_seq;
     int counter_p, counter_x, counter_c;
@@ -51,17 +52,18 @@ typedef struct {
     size_t len, size;
     uint8_t data[];
 } user_buffer_t;
-static inline user_buffer_t * user_buffer_create( size_t size )
+static inline user_buffer_t * user_buffer_create( pvc_t pool, size_t size )
 {
-    user_buffer_t * const p = malloc( sizeof(user_buffer_t) + size );
-    assert( p );
+    user_buffer_t * const p = pvc_pool_get( pool );
+    if ( !p )
+        return NULL;
     memset( p, 0, sizeof(*p) );
     p->size = size;
     return p;
 }
-static inline void user_buffer_destroy( user_buffer_t *data )
+static inline void user_buffer_destroy( pvc_t pool, user_buffer_t *data )
 {
-    free( data );
+    pvc_pool_put( pool, data );
 }
 static inline int user_buffer_append( user_buffer_t *data, void *buf, size_t len )
 {
@@ -96,10 +98,15 @@ static int produce_data( void *ctx, void **pdata )
 {
     const pvc_info_t * const info = pvc_get_info();
     context_t * const c = ctx;
-    user_buffer_t *value = user_buffer_create( MAX_PKT_SIZE );
+    user_buffer_t *value = user_buffer_create( c->pool, MAX_PKT_SIZE );
+    if ( !value ) {
+        *pdata = NULL;
+        return -1;
+    }
     user_buffer_append( value, &c->gen_seq, sizeof(c->gen_seq) );
     value->len += get_timestamp( value->data + value->len, value->size - value->len );
     *pdata = value;
+    pvc_declare_size( value->len );
     c->gen_seq++;
 
     if (1) {
@@ -158,6 +165,7 @@ static int xmit_data( void *ctx, void **pdata )
         }
         recved_len += ret;
     } while ( recved_len < value->len );
+    pvc_declare_size( value->len );
 
     if (1) {
         uint32_t *pseq;
@@ -187,7 +195,7 @@ static int consume_data( void *ctx, void *data )
         SHOWDATA( 'X', "send", ++c->counter_x, info, value, "seq=%u, ts0=" TS_FMT() ", ts1=" TS_FMT() "\n", *pseq, TS_ARG(pts0), TS_ARG(pts1) );
     }
 
-    free( value );
+    user_buffer_destroy( c->pool, value );
     return 0;
 }
 static int cleanup_data( void *ctx, void *data )
@@ -197,7 +205,7 @@ static int cleanup_data( void *ctx, void *data )
     user_buffer_t *value = data;
     //usleep( 1313 ); // to simulate I/O blocking
     printf( "-#%d:\tthread #%d(-%d): tid=%p, consume: l=%zd, data={%u,%u,%u}\n", ++c->counter_c, info->index, info->sub_index, pthread_self(), value->len, value->data[0], value->data[1], value->data[2] );
-    free( value );
+    user_buffer_destroy( c->pool, value );
     return 0;
 }
 
@@ -231,13 +239,14 @@ int main( int argc, char *argv[] )
     context_t ctx = { &running };
     pvc_t pvc_send, pvc_recv;
     int n_max_elems, n_producer, n_xmitter, n_consumer;
+    size_t n_max_bytes;
     int port;
     char * ipaddr;
 
     setbuf( stdout, NULL );
 
     if ( argc > 1 && !strcmp( argv[ argc - 1 ], "-h" ) ) {
-        printf( "Usage: %s [IP] [PORT] [NPROD] [NXMIT] [NCONS] [ELEMS]\n", argv[0] );
+        printf( "Usage: %s [IP] [PORT] [NPROD] [NXMIT] [NCONS] [ELEMS] [BYTES]\n", argv[0] );
         exit( 0 );
     }
 
@@ -248,14 +257,26 @@ int main( int argc, char *argv[] )
     n_xmitter   = argc > 4 ? atoi( argv[4] ) : 4;
     n_consumer  = argc > 5 ? atoi( argv[5] ) : 5;
     n_max_elems = argc > 6 ? atoi( argv[6] ) : 30;
+    n_max_bytes = argc > 7 ? atoi( argv[7] ) : 0;
 
     pvc_send = pvc_open( n_max_elems );
     pvc_recv = pvc_open( n_max_elems );
+    pvc_set_byte_budget( pvc_send, n_max_bytes, 0 );
+    pvc_set_byte_budget( pvc_recv, n_max_bytes, 0 );
+
+    // packets live from produce_data() on pvc_send to consume_data() on
+    // pvc_recv, so the pool of pvc_send covers both rings
+    ctx.pool = pvc_send;
+    pvc_set_pool( pvc_send, sizeof(user_buffer_t) + MAX_PKT_SIZE,
+                  2 * n_max_elems + ( n_producer + n_xmitter + n_consumer + 2 ) * ( PVC_POOL_CACHE + 1 ) );
 
     pvc_add_producer( pvc_send, produce_data, n_producer );
     pvc_chain( pvc_send, pvc_recv, xmit_data, n_xmitter );
     pvc_add_consumer( pvc_recv, consume_data, n_consumer );
 
+    pvc_set_stage_profiling( pvc_send, 1 );
+    pvc_set_stage_profiling( pvc_recv, 1 );
+
     ctx.toaddr.sin_family = AF_INET;
     ctx.toaddr.sin_port = htons( port );
     inet_aton( ipaddr, &ctx.toaddr.sin_addr );
@@ -273,6 +294,13 @@ int main( int argc, char *argv[] )
     pvc_stop( pvc_send, cleanup_data, &ctx ); // have to stop source chain first
     pvc_stop( pvc_recv, cleanup_data, &ctx );
 
+    if (1) {
+        const pvc_t pipeline[] = { pvc_send, pvc_recv };
+        pvc_stage_stats_t stages[4];
+        int n_stages = pvc_analyze( pipeline, 2, stages, 4 );
+        pvc_print_analysis( stages, n_stages );
+    }
+
     pvc_close( pvc_send );
     pvc_close( pvc_recv );
 
@@ -128,11 +128,11 @@ void *server_thread( void *arg )
 
     eliminate_connection( &ctx->fd );
 
-    free( ctx );
-
     if ( ctx->threads )
         --*ctx->threads; // assert atomic
 
+    free( ctx );
+
     return NULL;
 }
 void *listen_thread( void *arg )